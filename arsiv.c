@@ -418,8 +418,7 @@ int redirect(char *args[], int background, char *envPath) { /*checks for any red
     /*find any redirect arg if exists*/
     char *args_clones[CHAR_LIMIT / 2 + 1];
     int i = 0, ptr1 = 0, ptr2 = 0, check=0;
-    int size = sizeof args
-    for(i; i< size;i++) {
+    for(i = 0; args[i] != NULL; i++) {
         if(strcmp("<", args[i]) == 0 ||strcmp(">>", args[i]) == 0 ||
            strcmp("2>", args[i]) == 0 || strcmp(">", args[i]) == 0 ){
             check =1;
@@ -532,6 +531,7 @@ int redirect(char *args[], int background, char *envPath) { /*checks for any red
         fg_pid = 0;
     }
 
+    return 1;
 }
 
 void executeCommand(int background, char **args, char *envPath) {
@@ -0,0 +1,720 @@
+#define _GNU_SOURCE    // memmem()
+#include <stdio.h>     // Standard I/O library functions
+#include <unistd.h>    // UNIX standard function definitions
+#include <errno.h>     // Error number definitions
+#include <stdlib.h>    // Standard library definitions
+#include <string.h>    // String operation functions
+#include <fcntl.h>     // File control options
+#include <signal.h>    // Signal handling functions
+#include <poll.h>      // poll() with a timeout on the shell's output
+#include <time.h>      // clock_gettime()
+#include <sys/types.h> // Data types
+#include <sys/wait.h>  // Declarations for waiting
+#include <sys/stat.h>  // mkdir() and stat() for the I/O workloads
+#include <limits.h>    // realpath()
+
+/*
+ * shbench drives shell binaries the way a user does: it writes one command
+ * line, waits for the next "myshell: " prompt and takes the time in between
+ * as the latency of that command.
+ *
+ * With -r it replays a session recorded by MYSHELL_RECORD=<file> instead of
+ * the built-in workloads, optionally keeping the recorded think time (-t).
+ *
+ * With -s it writes a script of -n lines and times "<shell> <script>"
+ * instead, which also works for sh and dash.
+ *
+ * With -i it creates -n small files, one large file and a log and times
+ * the I/O builtins on them with each MYSHELL_IO backend, io_uring and
+ * read/write. Shells without the builtins run cat, wc, tee and grep(1).
+ */
+
+#define PROMPT "myshell: "    /* Printed by every variant before reading a line */
+#define READ_BUFFER 65536     /* Shell output read at once */
+#define PROMPT_TIMEOUT 5000   /* Milliseconds before a shell is declared stuck */
+#define DEFAULT_COUNT 500     /* Commands per workload */
+#define SCRIPT_LINE "/bin/true\n" /* External command, so no shell can run it as a builtin */
+#define SCRIPT_RUNS 5         /* Script runs per shell, the fastest one is reported */
+#define IO_LARGE_SIZE (64 << 20) /* Bytes in the large file of the I/O workloads */
+
+/* A scripted workload, the same line is sent count times */
+struct workload
+{
+    const char *name;
+    const char *line;
+    const char *input; // I/O workloads: file whose size gives MB/s
+};
+
+struct workload workloads[] = {
+    {"storm", "true\n"},                                    // Simple command storm
+    {"pipe", "echo hello | cat\n"},                         // 2-stage pipe
+    {"redirect", "echo hello > /tmp/shbench.out\n"},        // Output redirection
+    {"background", "true &\n"},                             // Background storm
+};
+
+/* I/O workloads, run with -c in the directory of test files */
+struct workload ioWorkloads[] = {
+    {"cat-small", "cat small/* > out", "out"},                    // Many small files, batched by io_uring
+    {"wc-large", "wc large > /dev/null", "large"},                // Read ahead while counting
+    {"tee-large", "cat large | tee out > /dev/null", "large"},    // Two writes and a read per chunk
+    {"grep-fixed", "grep -c ERROR log > out", "log"},             // Substring search, not /dev/null where grep(1) stops early
+    {"grep-regex", "grep -c ERROR.*full log > out", "log"},       // Literal prefilter, then the regex
+    {"grep-pipe", "cat log | grep disk > out", "log"},            // Last stage of a pipe
+};
+
+/* MYSHELL_IO values compared by -i */
+const char *ioBackends[] = {"uring", "rw"};
+
+/* One recorded input line */
+struct sessionLine
+{
+    double delay; // Microseconds since the previous line
+    char *text;   // Line including the newline
+};
+
+/* A running shell connected through two pipes */
+struct shellProc
+{
+    pid_t pid;
+    int in;                    // Shell's stdin
+    int out;                   // Shell's stdout
+    char buffer[READ_BUFFER];  // Output not matched against the prompt yet
+    size_t length;
+};
+
+/* Function prototypes */
+double nowMicros(void);                                                            // Monotonic time in microseconds
+int startShell(const char *path, struct shellProc *sh);                            // Starts a shell and waits for its first prompt
+int waitPrompt(struct shellProc *sh);                                              // Consumes output up to the next prompt
+void stopShell(struct shellProc *sh);                                              // Closes stdin and reaps the shell
+int runWorkload(const char *path, const struct workload *load, int count);         // Runs one workload against one shell
+void report(const char *shell, const char *name, double *samples, int count, double total); // Prints one result line
+int compareSamples(const void *a, const void *b);                                  // qsort() comparator
+int loadSession(const char *path, struct sessionLine **lines);                     // Reads a recorded session
+int runSession(const char *path, struct sessionLine *lines, int count, int realTime, int verbose); // Replays it against one shell
+int runScriptBench(const char *path, const char *script, int count);               // Times a shell running a script file
+int makeIoFiles(const char *dir, int count);                                       // Creates the files of the I/O workloads
+void removeIoFiles(const char *dir, int count);                                    // Deletes them again
+int runIoBench(const char *path, const char *dir, const struct workload *load, const char *backend); // Times one I/O workload
+
+int main(int argc, char *argv[])
+{
+    int count = DEFAULT_COUNT;
+    const char *only = NULL;
+    const char *session = NULL;
+    int realTime = 0, verbose = 0, scriptMode = 0, ioMode = 0;
+    int opt;
+
+    signal(SIGPIPE, SIG_IGN); // A crashed shell must not kill the harness
+
+    while ((opt = getopt(argc, argv, "n:w:r:tvsi")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'w':
+            only = optarg;
+            break;
+        case 'r':
+            session = optarg;
+            break;
+        case 't':
+            realTime = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 's':
+            scriptMode = 1;
+            break;
+        case 'i':
+            ioMode = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n count] [-w workload] [-r session [-t] [-v]] [-s] [-i] shell...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || count <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-n count] [-w workload] [-r session [-t] [-v]] [-s] [-i] shell...\n", argv[0]);
+        return 1;
+    }
+
+    if (scriptMode)
+    {
+        /* The same script for every shell */
+        char script[] = "/tmp/shbench-script-XXXXXX";
+        int fd = mkstemp(script);
+        FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (out == NULL)
+        {
+            fprintf(stderr, "Cannot create the benchmark script\n");
+            return 1;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            fputs(SCRIPT_LINE, out);
+        }
+        fclose(out);
+
+        printf("%-22s %-11s %10s %9s\n", "shell", "script", "lines/s", "wall ms");
+        for (int i = optind; i < argc; i++)
+        {
+            if (runScriptBench(argv[i], script, count) != 0)
+            {
+                printf("%-22s %-11s %10s\n", argv[i], "script", "failed");
+            }
+        }
+        unlink(script);
+        return 0;
+    }
+
+    if (ioMode)
+    {
+        char dir[] = "/tmp/shbench-io-XXXXXX";
+        if (mkdtemp(dir) == NULL || makeIoFiles(dir, count) != 0)
+        {
+            fprintf(stderr, "Cannot create the I/O benchmark files\n");
+            return 1;
+        }
+        printf("%-22s %-11s %-7s %9s %9s\n", "shell", "workload", "backend", "wall ms", "MB/s");
+        for (int i = optind; i < argc; i++)
+        {
+            for (size_t w = 0; w < sizeof(ioWorkloads) / sizeof(ioWorkloads[0]); w++)
+            {
+                for (size_t b = 0; b < sizeof(ioBackends) / sizeof(ioBackends[0]); b++)
+                {
+                    if (only != NULL && strcmp(only, ioWorkloads[w].name) != 0)
+                    {
+                        continue;
+                    }
+                    if (runIoBench(argv[i], dir, &ioWorkloads[w], ioBackends[b]) != 0)
+                    {
+                        printf("%-22s %-11s %-7s %9s\n", argv[i], ioWorkloads[w].name, ioBackends[b], "failed");
+                    }
+                }
+            }
+        }
+        removeIoFiles(dir, count);
+        return 0;
+    }
+
+    if (session != NULL)
+    {
+        struct sessionLine *lines;
+        int lineCount = loadSession(session, &lines);
+        if (lineCount <= 0)
+        {
+            fprintf(stderr, "No input lines in session %s\n", session);
+            return 1;
+        }
+        printf("%-22s %-11s %10s %9s %9s %9s %9s %9s\n", "shell", "session", "cmds/s", "p50 us", "p90 us", "p99 us", "max us", "wall s");
+        for (int i = optind; i < argc; i++)
+        {
+            if (runSession(argv[i], lines, lineCount, realTime, verbose) != 0)
+            {
+                printf("%-22s %-11s %10s\n", argv[i], "replay", "failed");
+            }
+        }
+        return 0;
+    }
+
+    printf("%-22s %-11s %10s %9s %9s %9s %9s\n", "shell", "workload", "cmds/s", "p50 us", "p90 us", "p99 us", "max us");
+    for (int i = optind; i < argc; i++)
+    {
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+        {
+            if (only != NULL && strcmp(only, workloads[w].name) != 0)
+            {
+                continue;
+            }
+            if (runWorkload(argv[i], &workloads[w], count) != 0)
+            {
+                printf("%-22s %-11s %10s\n", argv[i], workloads[w].name, "failed");
+            }
+        }
+    }
+    return 0;
+}
+
+/* Monotonic clock in microseconds */
+double nowMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Starts a shell with its stdin and stdout on pipes and waits for its first prompt */
+int startShell(const char *path, struct shellProc *sh)
+{
+    int toShell[2], fromShell[2];
+    if (pipe(toShell) == -1 || pipe(fromShell) == -1)
+    {
+        fprintf(stderr, "Pipe creation failed\n");
+        return -1;
+    }
+
+    sh->pid = fork();
+    if (sh->pid < 0)
+    {
+        fprintf(stderr, "Fork failed\n");
+        return -1;
+    }
+
+    if (sh->pid == 0)
+    {
+        /* Child: becomes the shell under test */
+        dup2(toShell[0], STDIN_FILENO);
+        dup2(fromShell[1], STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDERR_FILENO); // Error messages would only slow the run down
+        close(devNull);
+        close(toShell[0]);
+        close(toShell[1]);
+        close(fromShell[0]);
+        close(fromShell[1]);
+        execl(path, path, (char *)NULL);
+        _exit(127);
+    }
+
+    close(toShell[0]);
+    close(fromShell[1]);
+    sh->in = toShell[1];
+    sh->out = fromShell[0];
+    sh->length = 0;
+    return waitPrompt(sh);
+}
+
+/* Reads the shell's output until the prompt shows up, returns -1 on timeout or EOF */
+int waitPrompt(struct shellProc *sh)
+{
+    size_t promptLength = strlen(PROMPT);
+
+    while (1)
+    {
+        /* The prompt can be split across reads, so search the whole buffered tail */
+        char *found = memmem(sh->buffer, sh->length, PROMPT, promptLength);
+        if (found != NULL)
+        {
+            size_t used = found - sh->buffer + promptLength;
+            memmove(sh->buffer, sh->buffer + used, sh->length - used);
+            sh->length -= used;
+            return 0;
+        }
+
+        /* Keep only what could still be the start of a prompt */
+        if (sh->length >= promptLength)
+        {
+            memmove(sh->buffer, sh->buffer + sh->length - (promptLength - 1), promptLength - 1);
+            sh->length = promptLength - 1;
+        }
+
+        struct pollfd pfd = {sh->out, POLLIN, 0};
+        int ready = poll(&pfd, 1, PROMPT_TIMEOUT);
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            return -1; // Stuck or broken shell
+        }
+
+        ssize_t n = read(sh->out, sh->buffer + sh->length, sizeof(sh->buffer) - sh->length);
+        if (n <= 0)
+        {
+            return -1; // Shell exited
+        }
+        sh->length += n;
+    }
+}
+
+/* Sends EOF (Ctrl+D) and reaps the shell */
+void stopShell(struct shellProc *sh)
+{
+    close(sh->in);
+    close(sh->out);
+    int status;
+    for (int i = 0; i < 100; i++)
+    {
+        if (waitpid(sh->pid, &status, WNOHANG) == sh->pid)
+        {
+            return;
+        }
+        usleep(10000);
+    }
+    kill(sh->pid, SIGKILL); // Shells that ignore EOF
+    waitpid(sh->pid, &status, 0);
+}
+
+/* Sends the workload's line count times, one at a time, and reports the latencies */
+int runWorkload(const char *path, const struct workload *load, int count)
+{
+    struct shellProc *sh = malloc(sizeof(struct shellProc));
+    double *samples = malloc(count * sizeof(double));
+    int result = -1;
+
+    if (sh == NULL || samples == NULL || startShell(path, sh) != 0)
+    {
+        goto done;
+    }
+
+    size_t lineLength = strlen(load->line);
+    double begin = nowMicros();
+    int completed;
+    for (completed = 0; completed < count; completed++)
+    {
+        double start = nowMicros();
+        if (write(sh->in, load->line, lineLength) != (ssize_t)lineLength || waitPrompt(sh) != 0)
+        {
+            break;
+        }
+        samples[completed] = nowMicros() - start;
+    }
+    double total = nowMicros() - begin;
+    stopShell(sh);
+
+    if (completed == count)
+    {
+        report(path, load->name, samples, count, total);
+        printf("\n");
+        result = 0;
+    }
+
+done:
+    free(samples);
+    free(sh);
+    return result;
+}
+
+/* Loads "line <delay> <text>" records, the terminal size is exported as LINES/COLUMNS */
+int loadSession(const char *path, struct sessionLine **lines)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        fprintf(stderr, "Cannot open session %s\n", path);
+        return -1;
+    }
+
+    char *record = NULL;
+    size_t recordSize = 0;
+    int count = 0, capacity = 0;
+    *lines = NULL;
+
+    while (getline(&record, &recordSize, in) != -1)
+    {
+        int rows, cols, offset;
+        double delay;
+
+        if (sscanf(record, "winsize %d %d", &rows, &cols) == 2)
+        {
+            /* Pipes have no window size, so the first one is handed over through the environment */
+            if (count == 0 && rows > 0 && cols > 0)
+            {
+                char value[16];
+                snprintf(value, sizeof(value), "%d", rows);
+                setenv("LINES", value, 1);
+                snprintf(value, sizeof(value), "%d", cols);
+                setenv("COLUMNS", value, 1);
+            }
+            continue;
+        }
+        if (sscanf(record, "line %lf %n", &delay, &offset) != 1)
+        {
+            continue; // Header or comment
+        }
+
+        /* Undo the recorder's escaping and put the newline back */
+        char *text = malloc(strlen(record) + 2);
+        int n = 0;
+        for (char *c = record + offset; *c != '\0' && *c != '\n'; c++)
+        {
+            if (*c == '\\' && c[1] != '\0')
+            {
+                c++;
+                text[n++] = *c == 'n' ? '\n' : *c == 't' ? '\t' : *c;
+            }
+            else
+            {
+                text[n++] = *c;
+            }
+        }
+        text[n++] = '\n';
+        text[n] = '\0';
+
+        if (strcmp(text, "exit\n") == 0)
+        {
+            free(text); // The harness ends the session with EOF itself
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            *lines = realloc(*lines, capacity * sizeof(struct sessionLine));
+        }
+        (*lines)[count].delay = delay;
+        (*lines)[count].text = text;
+        count++;
+    }
+
+    free(record);
+    fclose(in);
+    return count;
+}
+
+/* Feeds the session through the shell's prompt loop and reports per-command latency and wall time */
+int runSession(const char *path, struct sessionLine *lines, int count, int realTime, int verbose)
+{
+    struct shellProc *sh = malloc(sizeof(struct shellProc));
+    double *samples = malloc(count * sizeof(double));
+    int result = -1;
+
+    if (sh == NULL || samples == NULL || startShell(path, sh) != 0)
+    {
+        goto done;
+    }
+
+    double begin = nowMicros();
+    int completed;
+    for (completed = 0; completed < count; completed++)
+    {
+        if (realTime && lines[completed].delay > 0)
+        {
+            usleep((useconds_t)lines[completed].delay); // Recorded think time, not part of the latency
+        }
+
+        size_t length = strlen(lines[completed].text);
+        double start = nowMicros();
+        if (write(sh->in, lines[completed].text, length) != (ssize_t)length || waitPrompt(sh) != 0)
+        {
+            break;
+        }
+        samples[completed] = nowMicros() - start;
+
+        if (verbose)
+        {
+            printf("%10.0f us  %.*s\n", samples[completed], (int)length - 1, lines[completed].text);
+        }
+    }
+    double total = nowMicros() - begin;
+    stopShell(sh);
+
+    if (completed == count)
+    {
+        /* Throughput only counts time spent in the shell, not the replayed think time */
+        double busy = 0;
+        for (int i = 0; i < count; i++)
+        {
+            busy += samples[i];
+        }
+        report(path, "replay", samples, count, busy);
+        printf(" %9.3f\n", total / 1e6);
+        result = 0;
+    }
+
+done:
+    free(samples);
+    free(sh);
+    return result;
+}
+
+/* Runs "<shell> <script>" a few times and reports the best wall time */
+int runScriptBench(const char *path, const char *script, int count)
+{
+    double best = 0;
+
+    for (int run = 0; run < SCRIPT_RUNS; run++)
+    {
+        double start = nowMicros();
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            return -1;
+        }
+        if (pid == 0)
+        {
+            int devNull = open("/dev/null", O_RDWR);
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            execl(path, path, script, (char *)NULL);
+            _exit(127);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        double elapsed = nowMicros() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+        {
+            return -1;
+        }
+        if (run == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    printf("%-22s %-11s %10.0f %9.1f\n", path, "script", count / (best / 1e6), best / 1e3);
+    return 0;
+}
+
+/* Writes count small files below dir/small, one of IO_LARGE_SIZE bytes as dir/large and a log as big as dir/log */
+int makeIoFiles(const char *dir, int count)
+{
+    char path[4096], line[64];
+    snprintf(path, sizeof(path), "%s/small", dir);
+    if (mkdir(path, 0755) != 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/small/%06d", dir, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int length = snprintf(line, sizeof(line), "small file %d of %d\n", i, count);
+        if (fd < 0 || write(fd, line, length) != length)
+        {
+            return -1;
+        }
+        close(fd);
+    }
+
+    snprintf(path, sizeof(path), "%s/large", dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    static char block[65536];
+    for (size_t i = 0; i < sizeof(block); i++)
+    {
+        block[i] = i % 64 == 63 ? '\n' : i % 8 == 7 ? ' ' : 'a' + i % 26;
+    }
+    for (int written = 0; written < IO_LARGE_SIZE; written += sizeof(block))
+    {
+        if (write(fd, block, sizeof(block)) != sizeof(block))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    /* Mostly INFO lines, one ERROR in 1000 of which a few mention the disk */
+    snprintf(path, sizeof(path), "%s/log", dir);
+    FILE *log = fopen(path, "w");
+    if (log == NULL)
+    {
+        return -1;
+    }
+    for (long i = 0; ftell(log) < IO_LARGE_SIZE; i++)
+    {
+        if (i % 1000 == 999)
+            fprintf(log, "2024-05-%02ld 12:%02ld:%02ld host%ld kernel: ERROR %s\n", i % 28 + 1, i / 60 % 60, i % 60, i % 7,
+                    i % 3000 == 2999 ? "disk full on /dev/sda1" : "request timed out");
+        else
+            fprintf(log, "2024-05-%02ld 12:%02ld:%02ld host%ld app[%ld]: INFO request %ld served in %ld ms\n", i % 28 + 1,
+                    i / 60 % 60, i % 60, i % 7, 1000 + i % 97, i, i % 250);
+    }
+    fclose(log);
+    return 0;
+}
+
+/* Removes what makeIoFiles() and the workloads created */
+void removeIoFiles(const char *dir, int count)
+{
+    char path[4096];
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/small/%06d", dir, i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/small", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/large", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/log", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/out", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+/* Runs "<shell> -c <line>" in dir with MYSHELL_IO=backend and reports the fastest of SCRIPT_RUNS */
+int runIoBench(const char *path, const char *dir, const struct workload *load, const char *backend)
+{
+    double best = 0;
+    char shell[4096];
+    if (realpath(path, shell) == NULL)
+    {
+        return -1; // The shell runs in dir, a relative path would not resolve there
+    }
+
+    for (int run = 0; run < SCRIPT_RUNS; run++)
+    {
+        double start = nowMicros();
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            return -1;
+        }
+        if (pid == 0)
+        {
+            int devNull = open("/dev/null", O_RDWR);
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            if (chdir(dir) != 0)
+            {
+                _exit(127);
+            }
+            setenv("MYSHELL_IO", backend, 1);
+            execl(shell, path, "-c", load->line, (char *)NULL);
+            _exit(127);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        double elapsed = nowMicros() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) > 1) // grep exits 1 when nothing matched
+        {
+            return -1;
+        }
+        if (run == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    struct stat st;
+    char file[4096];
+    snprintf(file, sizeof(file), "%s/%s", dir, load->input);
+    double bytes = stat(file, &st) == 0 ? st.st_size : 0;
+    printf("%-22s %-11s %-7s %9.1f %9.0f\n", path, load->name, backend, best / 1e3, bytes / best);
+    return 0;
+}
+
+/* Prints throughput and latency percentiles for one shell and workload, the caller ends the line */
+void report(const char *shell, const char *name, double *samples, int count, double total)
+{
+    qsort(samples, count, sizeof(double), compareSamples);
+    printf("%-22s %-11s %10.0f %9.0f %9.0f %9.0f %9.0f", shell, name,
+           count / (total / 1e6),
+           samples[count * 50 / 100],
+           samples[count * 90 / 100],
+           samples[count * 99 / 100],
+           samples[count - 1]);
+}
+
+/* Ascending order of latencies */
+int compareSamples(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
@@ -493,9 +493,33 @@ void executePipedCommands(char *args[], char *inputBuffer)
     }
     cmd2[cmd2_len] = NULL;
 
+    // Input file of cmd1 is opened once here and handed to the first child
+    int inputFd = -1;
+    for (int i = 0; cmd1[i] != NULL; i++)
+    {
+        if (strcmp(cmd1[i], "<") == 0)
+        {
+            if (cmd1[i + 1] == NULL)
+            {
+                fprintf(stderr, "Missing input file after '<'.\n");
+                return;
+            }
+            inputFd = open(cmd1[i + 1], O_RDONLY | O_CLOEXEC);
+            if (inputFd < 0)
+            {
+                perror("Error opening input file");
+                return;
+            }
+            cmd1[i] = NULL;
+            break;
+        }
+    }
+
     if (pipe(pipefd) == -1)
     {
         perror("Pipe creation failed");
+        if (inputFd >= 0)
+            close(inputFd);
         return;
     }
 
@@ -506,6 +530,10 @@ void executePipedCommands(char *args[], char *inputBuffer)
         close(pipefd[0]);               // Close unused read end
         dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to pipe write end
         close(pipefd[1]);
+        if (inputFd >= 0)
+        {
+            dup2(inputFd, STDIN_FILENO); // Read from the input file
+        }
 
         char fullPath[MAX_LINE] = {0};
         findCommandPath(cmd1[0], fullPath);
@@ -530,6 +558,25 @@ void executePipedCommands(char *args[], char *inputBuffer)
         dup2(pipefd[0], STDIN_FILENO); // Redirect stdin to pipe read end
         close(pipefd[0]);
 
+        // Output redirection of cmd2
+        for (int i = 0; cmd2[i] != NULL; i++)
+        {
+            if (strcmp(cmd2[i], ">") == 0 || strcmp(cmd2[i], ">>") == 0)
+            {
+                int flags = O_WRONLY | O_CREAT | (cmd2[i][1] == '>' ? O_APPEND : O_TRUNC);
+                int fd = cmd2[i + 1] != NULL ? open(cmd2[i + 1], flags, 0644) : -1;
+                if (fd < 0)
+                {
+                    perror("Error opening output file");
+                    exit(1);
+                }
+                dup2(fd, STDOUT_FILENO);
+                close(fd);
+                cmd2[i] = NULL;
+                break;
+            }
+        }
+
         char fullPath[MAX_LINE] = {0};
         findCommandPath(cmd2[0], fullPath);
         if (fullPath[0] == '\0')
@@ -548,6 +595,8 @@ void executePipedCommands(char *args[], char *inputBuffer)
     // Parent process: Close both ends of the pipe and wait for children
     close(pipefd[0]);
     close(pipefd[1]);
+    if (inputFd >= 0)
+        close(inputFd);
     waitpid(pid1, NULL, 0);
     waitpid(pid2, NULL, 0);
 }
@@ -0,0 +1,119 @@
+/*
+ * Regression checks for the grep builtin: every case runs grepCommand()
+ * and grep(1) on the same input and compares their output and exit
+ * status. The shell has no quoting, so patterns with | or ( could not
+ * reach the builtin from a command line; yyk.c is included instead.
+ */
+#define main shellMain
+#include "../yyk.c"
+#undef main
+
+/* Input every case reads */
+static const char *input =
+    "aab\nac\nabc\nabbc\naaab\nb\nxyz\na{2}b\nab}c\n2}b\n}c\n"
+    "colour\ncolor\ncolouur\nERROR disk full\nerror: disk\nfoo bar\nFOO\n";
+
+/* Options and pattern of each case, NULL terminated */
+static const char *cases[][4] = {
+    {"-E", "a{2}b", NULL},
+    {"-E", "a{0,1}b", NULL},
+    {"-E", "^a{1,}b$", NULL},
+    {"-E", "a{2,}b", NULL},
+    {"-E", "xa{0}b", NULL},
+    {"ab\\{0,1\\}c", NULL},
+    {"a\\{2\\}b", NULL},
+    {"-E", "a\\{2\\}b", NULL},
+    {"-F", "a{2}b", NULL},
+    {"-c", "-E", "a{2}b", NULL},
+    {"-v", "-E", "a{2}b", NULL},
+    {"-E", "colou?r", NULL},
+    {"colou\\?r", NULL},
+    {"-n", "colou*r", NULL},
+    {"ab*c", NULL},
+    {"-E", "ab+c", NULL},
+    {"-E", "(ab|x)c", NULL},
+    {"-E", "abc|xyz", NULL},
+    {"ab\\|xyz", NULL},
+    {"-E", "(col)?or", NULL},
+    {"-i", "error", NULL},
+    {"-E", "ERROR.*full", NULL},
+};
+
+/* Runs args[] with the builtin or, with system set, grep(1), leaving its output in out */
+int runGrep(char *args[], int system, char *out, size_t size)
+{
+    int pipefd[2];
+    if (pipe(pipefd) == -1)
+    {
+        perror("pipe");
+        exit(2);
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        if (system)
+        {
+            execvp("grep", args);
+            _exit(127);
+        }
+        _exit(grepCommand(args));
+    }
+    close(pipefd[1]);
+    size_t used = 0;
+    ssize_t n;
+    while (used < size - 1 && (n = read(pipefd[0], out + used, size - 1 - used)) > 0)
+    {
+        used += n;
+    }
+    out[used] = '\0';
+    close(pipefd[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return exitStatus(status);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/grepcheckXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, input, strlen(input)) != (ssize_t)strlen(input))
+    {
+        perror("grepcheck");
+        return 2;
+    }
+    close(fd);
+
+    int failures = 0, count = sizeof(cases) / sizeof(cases[0]);
+    for (int i = 0; i < count; i++)
+    {
+        char *args[8] = {"grep"};
+        int n = 1;
+        for (int j = 0; j < 4 && cases[i][j] != NULL; j++)
+        {
+            args[n++] = (char *)cases[i][j];
+        }
+        args[n++] = path;
+        args[n] = NULL;
+
+        static char builtin[8192], system[8192];
+        int builtinStatus = runGrep(args, 0, builtin, sizeof(builtin));
+        int systemStatus = runGrep(args, 1, system, sizeof(system));
+        if (builtinStatus != systemStatus || strcmp(builtin, system) != 0)
+        {
+            failures++;
+            printf("FAIL grep");
+            for (int j = 1; j < n - 1; j++)
+            {
+                printf(" %s", args[j]);
+            }
+            printf(": builtin exit %d\n%s--- grep(1) exit %d\n%s", builtinStatus, builtin, systemStatus, system);
+        }
+    }
+    unlink(path);
+    printf("grepcheck: %d of %d cases match grep(1)\n", count - failures, count);
+    return failures > 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE    // pipe2() and other Linux extensions
 #include <stdio.h>     // Standard I/O library functions
 #include <unistd.h>    // UNIX standard function definitions
 #include <errno.h>     // Error number definitions
@@ -8,41 +9,554 @@
 #include <fcntl.h>     // File control options
 #include <sys/stat.h>  // Data returned by the stat() function
 #include <signal.h>    // Signal handling functions
+#include <stdint.h>    // Fixed width integer types
+#include <sys/ioctl.h> // ioctl() for perf counters
+#include <poll.h>      // poll() for the first byte trace event
+#include <time.h>      // clock_gettime() for trace timestamps
+#include <sys/mman.h>  // Shared memory for the metrics counters
+#include <sys/syscall.h>         // Raw system call numbers
+#include <limits.h>                // PATH_MAX for glob paths
+#include <sys/sendfile.h>        // sendfile() for the copy builtin
+#include <linux/fs.h>            // FICLONE reflink ioctl
+#include <linux/io_uring.h>      // io_uring rings, used through raw system calls
+#include <sys/uio.h>             // struct iovec for registered buffers
+#include <regex.h>               // Regular expressions of the grep builtin
+#include <pthread.h>             // Threads of the sort builtin
+#ifdef __SSE2__
+#include <emmintrin.h>           // SSE2 substring search
+#endif
+#include <linux/perf_event.h>    // perf_event_open() attributes
 
-#define MAX_LINE 128        /* Maximum characters per command line */
+#define MAX_LINE 512        /* Maximum characters per command line */
 #define MAX_ARGS 32         /*Maximum different characters per command line*/
 #define MAX_HISTORY 10      /* Maximum number of commands in history */
 #define MAX_BG_PROCESSES 20 /* Maximum background processes allowed */
+#define PERF_EVENTS 5       /* Number of counters attached by perfstat */
+#define MAX_PERF_SLOTS 24   /* Processes that can be profiled at the same time */
+#define PATH_CACHE_SIZE 64  /* Slots in the command path hash table */
+#define LATENCY_BUCKETS 24  /* Power of two spawn latency buckets, in microseconds */
+#define SNAPSHOT_INTERVAL 60 /* Seconds between periodic state snapshots */
+#define SNAPSHOT_VERSION 1   /* Bumped whenever the snapshot layout changes */
+#define ARENA_BLOCK 65536    /* Bytes per argument arena block */
+#define GLOB_CACHE_SIZE 8    /* Directory listings kept for globbing */
+#define CAPTURE_MEMFD_SIZE (1 << 20) /* Command substitution output moves to a memfd past this size */
+#define MAX_HERE_DOCS 8      /* Here-documents per command line */
+#define MAX_PROC_SUBS 16     /* Open <(...) and >(...) pipes at a time */
+#define MAX_REDIRECTIONS 16  /* Redirections per command */
+#define MAX_STAGES 16        /* Commands in one pipe */
+#define APPEND_CACHE_SIZE 8  /* Append mode descriptors kept open for >> */
+#define APPEND_FD_BASE 64    /* Cached descriptors live at or above this number */
+#define URING_ENTRIES 64     /* Submission queue entries of the I/O builtins' ring */
+#define URING_BUFFERS 16     /* Registered buffers, also files read per batch */
+#define URING_BUFFER_SIZE 65536 /* Bytes per registered buffer */
+#define GREP_BUFFER (1 << 20) /* Bytes grep reads at once, grown for longer lines */
+#define WC_WINDOW (1 << 30)  /* Bytes of a regular file wc maps at a time */
+#define SORT_MEMORY (256 << 20) /* Bytes of text sort keeps in memory before spilling a run */
+#define SORT_BLOCK (4 << 20) /* Bytes sort reads at once from a pipe */
+#define SORT_THREADS 16      /* Most threads sorting one run */
+#define SORT_MAX_RUNS 32     /* Spilled runs before they are merged into one */
+#define STAT_ADD(field, n) __atomic_fetch_add(&shellStats->field, (n), __ATOMIC_RELAXED) /* Lock free counter update */
 
 /* Global variables */
 pid_t fg_pid = -1;                   // Foreground process ID
 pid_t bgProcesses[MAX_BG_PROCESSES]; // Array of background process IDs
 int bgCount = 0;                     // Count of background processes
+int interactive = 1;                 // 0 for -c and script files: no prompt, history or snapshot saving
+int execInPlace = 0;                 // Set while running the last command of -c, a script or a subshell
+int lastStatus = 0;                  // Exit status of the last command list
+
+/* Statuses of foreground children the SIGCHLD handler reaped before waitForeground() could */
+#define REAPED_SLOTS 32
+pid_t reapedPids[REAPED_SLOTS];
+int reapedStatus[REAPED_SLOTS];
+int reapedNext = 0;
+
+/* perfstat state */
+struct perfSlot
+{
+    pid_t pid;                // Profiled process, 0 when the slot is free
+    int fds[PERF_EVENTS];     // Counter file descriptors, -1 when unsupported
+    char name[32];            // Command name printed in the report
+};
+int perfstatMode = 0;                        // Set while running a command prefixed with perfstat
+int perfSync[2] = {-1, -1};                  // Holds the child until its counters are attached
+struct perfSlot perfSlots[MAX_PERF_SLOTS];   // Counters of processes that are not reaped yet
+
+/* pipestat state, one meter per pipe filled in by the meter process through a shared mapping */
+struct pipeMeter
+{
+    uint64_t bytes;       // Bytes spliced from the producer to the consumer
+    double start, end;    // Meter start and end of input, in microseconds
+    double producerWait;  // Microseconds spent waiting for the producer to write
+    double consumerWait;  // Microseconds spent waiting for the consumer to read
+    uint64_t queuedSum;   // Sum of the consumer pipe's FIONREAD samples
+    uint64_t queuedMax;   // Largest sample
+    uint64_t samples;     // Samples taken, one per splice
+};
+int pipestatMode = 0; // Set while running a pipe prefixed with pipestat
+
+/* Trace state */
+int traceFd = -1; // Chrome trace-event file, -1 when tracing is off
+
+/* Metrics, kept in a shared mapping so forked children can count their exec failures */
+struct statsBlock
+{
+    uint64_t commands;                      // Command lines executed
+    uint64_t forks;                         // Successful fork() calls
+    uint64_t execFailures;                  // Children that could not exec
+    uint64_t pathHits;                      // Command path cache hits
+    uint64_t pathMisses;                    // Command path cache misses
+    uint64_t globHits;                      // Directory listing cache hits
+    uint64_t globMisses;                    // Directory listings read with getdents64
+    uint64_t appendHits;                    // >> targets served from the descriptor cache
+    uint64_t appendMisses;                  // >> targets opened
+    uint64_t pipeSignals;                   // Pipe stages stopped after their consumer exited
+    uint64_t bgStarted;                     // Background jobs started
+    uint64_t bgReaped;                      // Background jobs reaped
+    uint64_t spawnLatency[LATENCY_BUCKETS]; // Fork to exec time histogram
+    uint64_t spawnLatencySum;               // Sum of all spawn latencies in microseconds
+};
+struct statsBlock localStats;            // Used if the shared mapping cannot be created
+struct statsBlock *shellStats = &localStats;
+char *statsFile = NULL;                  // Prometheus text file rewritten by the shell
+int statsInterval = 10;                  // Seconds between rewrites of statsFile
+double statsWritten = 0;                 // Time of the last rewrite
+double spawnStart = 0;                   // Set before fork, read by the child before exec
+
+/* Command path cache */
+struct pathEntry
+{
+    char command[MAX_LINE];  // Command name, empty when the slot is free
+    char fullPath[MAX_LINE]; // Where PATH resolved it
+};
+struct pathEntry pathStorage[PATH_CACHE_SIZE];
+struct pathEntry *pathCache = pathStorage; // Points into the snapshot mapping when one was loaded
+char *pathCacheEnv = NULL;     // PATH value the cache was filled with
+char resolvedPath[MAX_LINE];   // Resolved by forkCommand() in the parent, used by execCommand() in the child
+
+/* Aliases, a chained hash table that doubles when it gets crowded */
+struct alias
+{
+    char *name;         // Alias name
+    char *value;        // Command line it expands to
+    struct alias *next; // Next alias in the same bucket
+};
+struct alias **aliasTable = NULL; // Buckets
+unsigned aliasBuckets = 0;        // Number of buckets, a power of two
+unsigned aliasCount = 0;          // Number of aliases
+
+/* Shell variables, the exported ones are also kept as a ready envp for execve() */
+struct variable
+{
+    char *text;        // NAME=value
+    size_t nameLength; // Length of NAME
+    int exported;      // Passed to commands
+    int owned;         // text was malloc()ed, not inherited from environ
+};
+struct variable *variables = NULL; // Every variable, in the order they were set
+int variableCount = 0;
+int variableCapacity = 0;
+char **environment = NULL;         // Exported NAME=value pointers, NULL terminated
+int environmentCount = 0;          // Entries in environment
+int environmentDirty = 1;          // A variable changed since environment was built
+
+/* Arguments after expansion live in an arena of blocks that is reset for every line */
+struct arenaBlock
+{
+    struct arenaBlock *next; // Next block, kept across resets
+    size_t used;             // Bytes handed out
+    size_t size;             // Bytes in data
+    char data[];
+};
+struct arenaBlock *arenaFirst = NULL;
+struct arenaBlock *arenaCurrent = NULL;
+
+/* Sorted directory listings, valid while the directory's (dev, ino, mtime) is unchanged */
+struct globListing
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int valid;               // 0 for empty slots and listings too recent to trust
+    char **names;            // Sorted entry names, pointing into buffer
+    int count;
+    char *buffer;            // The names, NUL separated
+    unsigned long lastUsed;  // For replacing the least recently used slot
+};
+struct globListing globCache[GLOB_CACHE_SIZE];
+unsigned long globClock = 0;
+
+/* Output of a command substitution, released with the arena */
+struct capture
+{
+    char *data;            // The output, split into fields in place
+    size_t size;           // Bytes of data that are mapped or allocated
+    int mapped;            // data is a memfd mapping instead of malloc() memory
+    struct capture *next;
+};
+struct capture *captures = NULL;
+
+/* Here-document bodies of the current line, found by the address of their delimiter word */
+struct hereDoc
+{
+    const char *delimiter; // The word after << in args[]
+    char *body;            // Lines up to the delimiter, released with the arena
+    size_t length;
+};
+struct hereDoc hereDocs[MAX_HERE_DOCS];
+int hereDocCount = 0;
+
+/* One redirection of a command; a command's list is applied left to right */
+#define REDIRECT_FILE 0      /* Open target onto fd */
+#define REDIRECT_DUP 1       /* n>&m, n<&m: fd becomes a copy of source */
+#define REDIRECT_CLOSE 2     /* n>&-: close fd */
+#define REDIRECT_HEREDOC 3   /* <<, <<- and <<< */
+#define REDIRECT_OPENED 4    /* Like REDIRECT_DUP, source was opened by the shell for this command */
+struct redirection
+{
+    int kind;             // REDIRECT_*
+    int fd;               // Descriptor being redirected
+    int flags;            // open() flags for REDIRECT_FILE
+    int source;           // Descriptor copied by REDIRECT_DUP
+    const char *operator; // The token, for here-documents
+    const char *target;   // File name or here-document word
+};
+
+/* Open >> targets, keyed by (dev, ino) and found by the path they were last opened with */
+struct appendEntry
+{
+    char *path;             // NULL for an empty slot
+    dev_t dev;
+    ino_t ino;
+    int fd;                 // O_APPEND, close-on-exec, at or above APPEND_FD_BASE
+    unsigned long lastUsed; // For replacing the least recently used entry
+};
+struct appendEntry appendCache[APPEND_CACHE_SIZE];
+unsigned long appendClock = 0;
+
+/* io_uring backend of cat, copy, tee and wc, set up on first use unless MYSHELL_IO=rw */
+struct uring
+{
+    int fd;                              // -1 before uringReady(), -2 when io_uring is unavailable
+    pid_t owner;                         // A forked child sets up a ring of its own
+    void *sqRing, *cqRing;               // Shared with the kernel, the same mapping with IORING_FEAT_SINGLE_MMAP
+    size_t sqRingSize, cqRingSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned queued;                     // Filled since the last uringRun()
+    unsigned inFlight;                   // Submitted and not reaped
+    int results[URING_ENTRIES];          // Completion results by user_data
+    char *buffers;                       // URING_BUFFERS registered buffers
+};
+struct uring ring = {.fd = -1};
+
+/* A compiled grep pattern and the options it runs with */
+struct grepPattern
+{
+    char literal[MAX_LINE];                 // Every matching line contains it, lowercase with -i
+    size_t literalLength;                   // 0 when nothing is known, every line is then a candidate
+    int regex;                              // 0 when the literal is the whole pattern
+    regex_t compiled;
+    int fold, invert, count, number, quiet; // -i, -v, -c, -n, -q
+    int names;                              // Prefix lines with the file name
+};
+char grepOutput[65536]; // Output of grep, written when full
+size_t grepOutputUsed = 0;
+
+/* A line to sort, pointing into a mapped file or a block read by sort */
+struct sortLine
+{
+    const char *text;
+    size_t length; // Without the newline
+    size_t order;  // Position in the input, makes the sort stable
+};
+
+/* One sorted sequence for the k-way merge: part of a line array or a mapped run file */
+struct sortCursor
+{
+    struct sortLine line;           // Current line
+    const struct sortLine *next, *end;
+    const char *text, *textEnd;     // Used when next is NULL
+};
+
+/* Buffered output of sort, to standard output or a run file */
+struct sortOutput
+{
+    int fd;
+    size_t used;
+    char data[65536];
+};
+
+/* Lines gathered for the next run */
+struct sortState
+{
+    struct sortLine *lines;
+    size_t count, capacity;
+    size_t bytes;          // Text in lines, a run is spilled past SORT_MEMORY
+    size_t added;          // Lines so far, for sortLine.order
+    char **blocks;         // Blocks read from pipes, freed with the run
+    int blockCount, blockCapacity;
+    int runs[SORT_MAX_RUNS]; // Sorted run files, already unlinked
+    int runCount;
+};
+int sortNumeric = 0, sortReverse = 0, sortUnique = 0; // -n, -r and -u for compareLines()
+
+/* Pipe ends of <(...) and >(...) kept open for the command that uses them */
+int procSubFds[MAX_PROC_SUBS];
+int procSubCount = 0;
+
+/* Input left over after the line returned by readInput() */
+char pendingInput[MAX_LINE];
+int pendingLength = 0;
+
+/* Script being run by runScript(), here-document bodies are read from it too */
+const char *scriptText = NULL;
+size_t scriptLength = 0;
+size_t scriptPosition = 0;
+
+/* A growable argv inside the arena */
+struct argList
+{
+    char **items;
+    int count;
+    int capacity;
+};
+
+/* History, points into the snapshot mapping when one was loaded */
+char historyStorage[MAX_HISTORY][MAX_LINE];
+char (*shellHistory)[MAX_LINE] = historyStorage;
+
+/*
+ * State snapshot. The file is the header followed by the history block, the
+ * path cache block, the alias offset pairs and a string pool. It is mapped
+ * MAP_PRIVATE at startup and the blocks are used in place, writes only copy
+ * the pages they touch.
+ */
+struct snapshotHeader
+{
+    char magic[8];           // "MYSHSNAP"
+    uint32_t version;        // SNAPSHOT_VERSION
+    uint32_t size;           // Size of the whole file
+    uint32_t maxLine;        // MAX_LINE of the writer
+    uint32_t maxHistory;     // MAX_HISTORY of the writer
+    uint32_t pathCacheSize;  // PATH_CACHE_SIZE of the writer
+    uint32_t historyOffset;  // History block
+    uint32_t pathOffset;     // Path cache block
+    uint32_t pathEnvOffset;  // PATH the cache belongs to, in the pool
+    uint32_t aliasOffset;    // aliasCount pairs of name and value offsets
+    uint32_t aliasCount;     // Number of aliases
+    uint32_t poolOffset;     // String pool, ends with a NUL byte
+    uint32_t statsInterval;  // stats file interval
+    uint32_t statsFileOffset; // stats file path in the pool, 0 if none
+};
+char *snapshotPath = NULL;        // NULL when snapshots are disabled
+char *snapshotBase = NULL;        // Mapping of the loaded snapshot
+size_t snapshotSize = 0;          // Length of the mapping
+struct alias *snapshotAliases = NULL; // One block holding the entries of the loaded aliases
+uint32_t snapshotAliasCount = 0;  // Entries in snapshotAliases
+double snapshotSaved = 0;         // Time of the last snapshot
+
+/* Session recording for bench/shbench -r */
+FILE *recordFile = NULL;       // Session file, NULL when not recording
+double recordLast = 0;         // Time of the previous recorded line
+struct winsize recordSize;     // Terminal size written last
 
 /* Function prototypes */
 void handleSigTSTP(int sig);                                                                         // Handler for SIGTSTP (Ctrl+Z)
 void handleSigCHLD(int sig);                                                                         // Handler for SIGCHLD (child termination)
-void setup(char inputBuffer[], char *args[], int *background);                                       // Parses input
+void setup(char inputBuffer[], char *args[]);                                                        // Reads and parses input
+void parseLine(char inputBuffer[], int length, char *args[]);                                        // Splits a line into tokens
+void executeLine(char *args[], int lastInPlace);                                                     // Runs a parsed line
+int isGroupOpen(const char *token);                                                                  // ( or {
+int isGroupClose(const char *token);                                                                 // ) or }
+int groupDepth(char *args[], int i, int depth);                                                      // Group nesting after args[i]
+int findClosing(char *args[], int start, int end);                                                   // Matching ) or }
+int executeList(char *args[], int start, int end, int lastInPlace);                                  // Runs a ; and & separated list
+int executeAndOr(char *args[], int start, int end, int background, int lastInPlace);                 // Runs a && and || chain
+int executePipeline(char *args[], int start, int end, int background, int lastInPlace);              // Runs a group or a command
+int executeCommand(char *args[], int background);                                                    // Runs a simple command or pipe
+int executeBuiltin(char *args[]);                                                                    // Runs a builtin in the shell
+int isBuiltin(char *args[]);                                                                         // Tells if args[] runs in the shell
+pid_t forkShell(void);                                                                               // Forks a subshell
+void addBackground(pid_t pid);                                                                       // Registers a background job
+int waitForeground(pid_t pid);                                                                       // Waits for a child, returns its status
+int waitPipeline(pid_t pids[], int count, int consumerGone, const int piped[]);                      // Waits for pipe stages as they finish
+int stopWriter(pid_t pid, int pidfd);                                                                // SIGPIPE for a stage whose reader exited
+int exitStatus(int status);                                                                          // waitpid() status to shell status
+void rememberReaped(pid_t pid, int status);                                                          // Keeps a status reaped by the handler
+int takeReaped(pid_t pid, int *status);                                                              // Fetches a status reaped by the handler
+void runScript(const char *text, size_t length);                                                     // Runs every line of a script
+void runScriptFile(const char *path);                                                                // Maps and runs a script file
 void findCommandPath(const char *command, char *fullPath);                                           // Finds command path
-void executeFromHistory(char *historyLine, char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE]); // Executes history command
-void addToHistory(char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE], int background);          // Adds command to history
+unsigned stringHash(const char *text);                                                               // FNV-1a hash for the hash tables
+int executeFromHistory(char *historyLine, char historyBuffer[MAX_HISTORY][MAX_LINE]);                // Executes history command
+void addToHistory(char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE]);                          // Adds command to history
 void printHistory(char historyBuffer[MAX_HISTORY][MAX_LINE]);                                        // Prints command history
-void moveToForeground(pid_t pid, pid_t bgProcesses[MAX_BG_PROCESSES], int *bgCount);                 // Brings BG process to FG
-void executePipedCommands(char *args[], char *inputBuffer);                                          // Executes piped commands
-void terminateProgram(int bgCount);                                                                  // Exits the shell
-int redirect(char *args[], int background);                                                          // Handles I/O redirection
+int moveToForeground(pid_t pid, pid_t bgProcesses[MAX_BG_PROCESSES], int *bgCount);                  // Brings BG process to FG
+int executePipedCommands(char *args[], int background);                                              // Executes piped commands
+void terminateProgram(int bgCount, int status);                                                      // Exits the shell
+int parseRedirections(char *args[], struct redirection list[]);                                      // Takes the redirections out of args[]
+int applyRedirections(struct redirection list[], int count, int saved[]);                            // Applies redirections in order
+void restoreRedirections(struct redirection list[], int count, int saved[]);                         // Undoes them for a builtin
+int appendFd(const char *path);                                                                      // Cached O_APPEND descriptor for a path
+void resolveAppends(struct redirection list[], int count);                                           // Swaps >> targets for cached descriptors
+int stripPrefix(char *args[], const char *word);                                                     // Detects the perfstat or pipestat prefix
+int startMeter(int input, struct pipeMeter *meter, pid_t *pid);                                      // Puts a pipestat meter after a pipe
+void runMeter(int in, int out, struct pipeMeter *meter);                                             // Splices one pipe into the next
+void pipestatReport(struct pipeMeter meters[], int count, char **stages[]);                          // Prints the pipestat summary
+void perfBeforeFork(void);                                                                           // Prepares the perfstat handshake
+void perfChildWait(void);                                                                            // Child side of the handshake
+void perfAttach(pid_t pid, const char *name);                                                        // Attaches counters to a child
+void perfReport(pid_t pid);                                                                          // Prints counters of a reaped child
+pid_t forkCommand(const char *name);                                                                 // Forks a child for a command
+pid_t forkUnlessLast(const char *name, int background);                                              // Skips the fork for the last command
+void execCommand(char *args[]);                                                                      // Execs a command in the child
+void childReaped(pid_t pid);                                                                         // Bookkeeping for a reaped child
+void traceStart(const char *path);                                                                   // Starts writing a trace file
+void traceStop(void);                                                                                // Finishes the trace file
+double nowMicros(void);                                                                              // Monotonic time in microseconds
+void traceEvent(const char *name, char phase, double start, double end, const char *detail);         // Writes one trace event
+void statsInit(void);                                                                                // Maps the shared counters
+void statsPrint(FILE *out, int prometheus);                                                          // Prints the counters
+uint64_t latencyQuantile(double quantile);                                                           // Spawn latency percentile
+void recordStart(const char *path);                                                                  // Starts recording the session
+struct alias *findAlias(const char *name);                                                           // Looks up an alias
+void setAlias(const char *name, const char *value);                                                  // Adds or replaces an alias
+int removeAlias(const char *name);                                                                   // Deletes an alias
+void listAliases(void);                                                                              // Prints every alias
+int aliasCommand(char *args[]);                                                                      // The alias builtin
+int expandAlias(char *args[]);                                                                       // Replaces aliases in command words
+void variablesInit(void);                                                                            // Loads the inherited environment
+struct variable *findVariable(const char *name, size_t length);                                      // Looks up a variable
+char *getVariable(const char *name);                                                                 // Value of a variable or NULL
+void setVariable(const char *assignment, int exported);                                              // Sets NAME=value
+void unsetVariable(const char *name);                                                                // Removes a variable
+void buildEnvironment(void);                                                                         // Rebuilds envp if a variable changed
+int assignmentLength(const char *word);                                                              // Length of NAME in NAME=value, or 0
+char *commandName(char *args[]);                                                                     // First word after the assignments
+int exportCommand(char *args[]);                                                                     // The export builtin
+int copyCommand(char *args[]);                                                                       // The copy builtin, also cat file > out
+int catToFile(char *args[], struct redirection list[], int count);                                   // Tells if cat can run as copy
+int copyFd(int in, int out);                                                                         // Copies in to out inside the kernel
+int copyRange(int in, int out, off_t length, int *method);                                           // Copies length bytes at the offsets
+int teeSupported(char *args[]);                                                                      // Tells if the tee builtin takes these options
+int teeCommand(char *args[]);                                                                        // The tee builtin
+int wcSupported(char *args[]);                                                                       // Tells if the wc builtin takes these options
+int wcCommand(char *args[]);                                                                         // The wc builtin
+void wcCount(const unsigned char *data, size_t length, uint64_t counts[3], int *inWord, int words);  // Adds lines, words and bytes
+int grepSupported(char *args[]);                                                                     // Tells if the grep builtin takes these options
+int grepCommand(char *args[]);                                                                       // The grep builtin
+size_t requiredLiteral(const char *pattern, int extended, char *literal, int *plain);                // Longest string every match contains
+const char *findString(const char *haystack, size_t length, const char *needle, size_t needleLength, int fold); // Substring search
+long grepFd(int fd, const char *name, struct grepPattern *pattern);                                  // Filters one input
+long grepLines(const char *data, size_t length, struct grepPattern *pattern, const char *name, unsigned long *lineNumber); // Filters whole lines
+void grepEmit(struct grepPattern *pattern, const char *name, unsigned long lineNumber, const char *line, size_t length); // Prints a selected line
+void grepFlush(void);                                                                                // Writes out buffered grep output
+int sortSupported(char *args[]);                                                                     // Tells if the sort builtin takes these options
+int sortCommand(char *args[]);                                                                       // The sort builtin
+int compareLines(const void *a, const void *b);                                                      // qsort() order of sort lines
+int compareKeys(const struct sortLine *x, const struct sortLine *y);                                 // Order by the sort options alone
+int compareCursors(const struct sortCursor *a, const struct sortCursor *b);                          // Heap order of merge cursors
+int compareNumbers(const char *a, size_t aLength, const char *b, size_t bLength);                    // -n order of leading numbers
+int sortAddText(struct sortState *state, const char *text, size_t length);                           // Splits text into lines
+int sortOpenRuns(struct sortState *state, struct sortCursor *cursors, void **maps, size_t *sizes);   // Maps the run files for merging
+int sortSpill(struct sortState *state);                                                              // Sorts the lines into a run file
+int sortParallel(struct sortLine *lines, size_t count, struct sortCursor *parts);                    // Sorts with threads, returns the parts
+void *sortThread(void *part);                                                                        // Sorts one part
+int sortMerge(struct sortCursor *cursors, int count, int fd);                                        // k-way merge into fd
+int sortAdvance(struct sortCursor *cursor);                                                          // Next line of a cursor, 0 at its end
+int sortTempFile(void);                                                                              // Anonymous file for a run
+void sortWrite(struct sortOutput *out, const char *data, size_t length);                             // Buffered write
+int uringReady(void);                                                                                // Sets up the ring, 0 for read/write
+struct io_uring_sqe *uringQueue(int opcode, int fd, int tag);                                        // Fills the next submission entry
+struct io_uring_sqe *uringQueueFixed(int opcode, int fd, int slot, unsigned length, int tag);        // Same with a registered buffer
+char *uringBuffer(int slot);                                                                         // Registered buffer number slot
+int uringRun(unsigned wait);                                                                         // Submits and waits for completions
+int uringCat(char *paths[], int count, int out);                                                     // Batched cat of files into out
+int uringStream(int in, int outs[], int outCount, off_t length);                                     // Double buffered copy to outs
+int writeAll(int fd, const char *data, size_t length, off_t offset);                                 // write() or pwrite() to the end
+void *arenaAlloc(size_t size);                                                                       // Memory that lives until the next line
+void arenaReset(void);                                                                               // Frees the arena for the next line
+char *arenaString(const char *text, size_t length);                                                  // Copies a string into the arena
+void argListAdd(struct argList *list, char *item);                                                   // Appends to an argv in the arena
+char **expandArguments(char *words[]);                                                               // Globs words into an arena argv
+int globMatch(const char *pattern, const char *name);                                                // Matches one path component
+struct globListing *readListing(const char *path);                                                   // Cached sorted listing of a directory
+void globPath(char *path, size_t length, const char *pattern, struct argList *out);                  // Expands pattern below path
+int compareNames(const void *a, const void *b);                                                      // qsort() order of names
+void globWord(char *word, struct argList *out);                                                      // Globs one word into out
+int substitutionEnd(const char *text, int i, int length);                                            // Closing ) or ` of a substitution
+char *captureOutput(const char *command, size_t length);                                             // Runs a command, returns its output
+void substituteWord(char *word, struct argList *out);                                                // Expands $(...) and `...` in a word
+int readInput(char *buffer, int size);                                                               // Reads one line of standard input
+void connectStage(int pipefd[2], int target);                                                        // Puts a pipe end on stdin or stdout
+void runSubshell(const char *command, size_t length);                                                // Runs a command list and exits
+char *processSubstitution(const char *word);                                                         // Starts <(...) or >(...)
+void closeSubstitutions(int first);                                                                  // Closes the shell's process substitution ends
+const char *readBodyLine(size_t *length);                                                            // Next line of a here-document body
+void collectHereDocs(char *args[]);                                                                  // Reads the bodies of << on a line
+int hereDocFd(const char *text, size_t length, int newline);                                         // Pipe or sealed memfd holding text
+int openHereDoc(const char *operator, const char *word);                                             // fd for a <<, <<- or <<< redirection
+int fromSnapshot(const void *pointer);                                                               // Tells if memory belongs to the snapshot
+void snapshotLoad(void);                                                                             // Maps the saved state
+void snapshotSave(int force);                                                                        // Writes the state
+int openTemporary(const char *path, char *tmpPath, size_t size);                                     // Unique temp file next to path
+uint32_t snapshotString(char **buffer, size_t *length, size_t *capacity, const char *text);           // Adds a string to the pool
+void recordLine(const char *line, int length);                                                       // Records one input line
+void statsExport(int force);                                                                         // Rewrites the metrics file
 
-int main(void)
+int main(int argc, char *argv[])
 {
     /* Set up signal handlers */
     signal(SIGTSTP, handleSigTSTP); // Handle Ctrl+Z
     signal(SIGCHLD, handleSigCHLD); // Handle child termination
 
     char inputBuffer[MAX_LINE];                      // Buffer to hold input
-    char historyBuffer[MAX_HISTORY][MAX_LINE] = {0}; // Command history
-    int background;                                  // Background execution flag
     char *args[MAX_LINE / 2 + 1];                    // Command arguments
 
+    statsInit();
+    variablesInit();
+
+    /* Saved aliases, history, path cache and settings, MYSHELL_STATE= disables it */
+    if (getenv("MYSHELL_STATE") != NULL)
+    {
+        snapshotPath = getenv("MYSHELL_STATE")[0] != '\0' ? strdup(getenv("MYSHELL_STATE")) : NULL;
+    }
+    else if (getenv("HOME") != NULL)
+    {
+        snapshotPath = malloc(strlen(getenv("HOME")) + 16);
+        sprintf(snapshotPath, "%s/.myshell_state", getenv("HOME"));
+    }
+    snapshotLoad();
+
+    /* MYSHELL_RECORD=<file> records the input for replay */
+    if (getenv("MYSHELL_RECORD") != NULL)
+    {
+        recordStart(getenv("MYSHELL_RECORD"));
+    }
+
+    /* MYSHELL_TRACE=<file> traces the whole session */
+    if (getenv("MYSHELL_TRACE") != NULL)
+    {
+        traceStart(getenv("MYSHELL_TRACE"));
+    }
+
+    /* -c 'command' and script files run without prompts */
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+    {
+        interactive = 0;
+        runScript(argv[2], strlen(argv[2]));
+        exit(lastStatus);
+    }
+    if (argc > 1)
+    {
+        interactive = 0;
+        runScriptFile(argv[1]);
+        exit(lastStatus);
+    }
+
     while (1)
     {
         /* Display prompt */
@@ -50,749 +564,6121 @@ int main(void)
         fflush(stdout);
 
         /* Parse input */
-        setup(inputBuffer, args, &background);
+        setup(inputBuffer, args);
+        executeLine(args, 0);
+    }
+
+    return 0;
+}
+
+/* Runs one parsed command line: counts it, keeps it in history and executes its command list */
+void executeLine(char *args[], int lastInPlace)
+{
+    int count = 0;
+    while (args[count] != NULL)
+    {
+        count++;
+    }
+    if (count == 0)
+        return; // Ignore empty input
+
+    STAT_ADD(commands, 1);
+    statsExport(0);
+    snapshotSave(0);
+
+    /* perfstat prefix profiles every process started for this line, pipestat meters its pipes, in either order */
+    perfstatMode = pipestatMode = 0;
+    for (;;)
+    {
+        if (!perfstatMode && stripPrefix(args, "perfstat"))
+            perfstatMode = 1;
+        else if (!pipestatMode && stripPrefix(args, "pipestat"))
+            pipestatMode = 1;
+        else
+            break;
+    }
+    if (args[0] == NULL)
+    {
+        fprintf(stderr, "Usage: %s <command>\n", pipestatMode ? "pipestat" : "perfstat");
+        return;
+    }
+    count -= perfstatMode + pipestatMode;
+
+    /* Add command to history, history commands themselves are not kept */
+    if (strcmp(args[0], "history") != 0)
+    {
+        addToHistory(args, shellHistory);
+    }
+
+    lastStatus = executeList(args, 0, count, lastInPlace);
+}
+
+/* Tells if a token opens a group: ( or { */
+int isGroupOpen(const char *token)
+{
+    return strcmp(token, "(") == 0 || strcmp(token, "{") == 0;
+}
+
+/* Tells if a token closes a group: ) or } */
+int isGroupClose(const char *token)
+{
+    return strcmp(token, ")") == 0 || strcmp(token, "}") == 0;
+}
+
+/*
+ * Group nesting after args[i], given the nesting before it. At the top a
+ * group only opens at a command position, the start or after a | (or a
+ * | already cut out as NULL), so `echo {` stays a word.
+ */
+int groupDepth(char *args[], int i, int depth)
+{
+    if (depth == 0)
+    {
+        return (i == 0 || args[i - 1] == NULL || strcmp(args[i - 1], "|") == 0) && isGroupOpen(args[i]);
+    }
+    return depth + isGroupOpen(args[i]) - isGroupClose(args[i]);
+}
+
+/* Index of the token closing the group opened at args[start], or -1 */
+int findClosing(char *args[], int start, int end)
+{
+    int depth = 0;
+    for (int i = start; i < end; i++)
+    {
+        if (isGroupOpen(args[i]))
+        {
+            depth++;
+        }
+        else if (isGroupClose(args[i]) && --depth == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
 
-        if (args[0] == NULL)
-            continue; // Ignore empty input
+/* Runs args[start..end) as a list of and-or lists separated by ; or & */
+int executeList(char *args[], int start, int end, int lastInPlace)
+{
+    int status = lastStatus;
+    int i = start;
 
-        /* Check for pipes */
-        int hasPipe = 0;
-        for (int i = 0; args[i] != NULL; i++)
+    while (i < end)
+    {
+        /* Find the separator ending this and-or list, skipping over groups */
+        int j = i, depth = 0;
+        while (j < end)
         {
-            if (strcmp(args[i], "|") == 0)
+            if (isGroupOpen(args[j]))
+            {
+                depth++;
+            }
+            else if (isGroupClose(args[j]))
+            {
+                depth--;
+            }
+            else if (depth == 0 && (strcmp(args[j], ";") == 0 || strcmp(args[j], "&") == 0))
             {
-                hasPipe = 1;
                 break;
             }
+            j++;
         }
 
-        if (hasPipe)
-        {
-            /* Handle piped commands */
-            addToHistory(args, historyBuffer, background);
-            executePipedCommands(args, inputBuffer);
-            continue;
-        }
-
-        /* Check for I/O redirection */
-        if (redirect(args, background))
+        int background = j < end && strcmp(args[j], "&") == 0;
+        int last = j + 1 >= end; // Nothing runs after this and-or list
+        if (j > i)
         {
-            addToHistory(args, historyBuffer, background);
-            continue;
+            status = executeAndOr(args, i, j, background, lastInPlace && last && !background);
         }
-
-        /* Built-in commands */
-        if (strcmp(args[0], "exit") == 0)
+        else if (j < end)
         {
-            terminateProgram(bgCount); // Exit shell
-            continue;
+            fprintf(stderr, "Syntax error near '%s'\n", args[j]);
+            return 2;
         }
+        i = j + 1;
+    }
+    return status;
+}
 
-        if (strcmp(args[0], "history") == 0)
+/* Runs pipelines joined by && and ||, skipping the ones the previous status rules out */
+int executeAndOr(char *args[], int start, int end, int background, int lastInPlace)
+{
+    /* A backgrounded chain runs as one job in a subshell */
+    if (background)
+    {
+        for (int i = start; i < end; i++)
         {
-            /* Handle history command */
-            if (args[1] == NULL)
-            {
-                printHistory(historyBuffer); // Print history
-            }
-            else
+            if (strcmp(args[i], "&&") == 0 || strcmp(args[i], "||") == 0)
             {
-                if (args[1][0] != '-' || args[1][1] != 'i')
+                pid_t pid = forkShell();
+                if (pid < 0)
                 {
-                    fprintf(stderr, "\"-i\" must be entered before the index.\n");
-                    continue;
-                }
-                int historyIndex = atoi(args[2]); // Get history index
-                if (historyIndex >= 0 && historyIndex < MAX_HISTORY)
-                {
-                    if (historyBuffer[historyIndex][0] != '\0')
-                    {
-                        char historyLine[MAX_LINE];
-                        strncpy(historyLine, historyBuffer[historyIndex], MAX_LINE);
-                        historyLine[MAX_LINE - 1] = '\0';
-                        executeFromHistory(historyLine, args, historyBuffer); // Execute history command
-                    }
-                    else
-                    {
-                        fprintf(stderr, "Error: No such history entry.\n");
-                    }
+                    fprintf(stderr, "Fork failed");
+                    return 1;
                 }
-                else
+                if (pid == 0)
                 {
-                    fprintf(stderr, "Error: Invalid history index.\n");
+                    exit(executeAndOr(args, start, end, 0, 1));
                 }
+                addBackground(pid);
+                return 0;
             }
-            continue;
         }
+    }
 
-        if (strcmp(args[0], "fg") == 0)
+    int status = 0, run = 1;
+    int i = start;
+    while (i < end)
+    {
+        int j = i, depth = 0;
+        while (j < end)
         {
-            /* Bring background process to foreground */
-            if (args[1] != NULL)
+            if (isGroupOpen(args[j]))
             {
-                if (args[1][0] != '%') /* Check syntax usage */
-                {
-                    fprintf(stderr, "Use fg with correct syntax.\n");
-                    continue;
-                }
-                char fgIndex[MAX_LINE];
-                int i;
-                for (i = 0; args[1][i] != '\0'; i++)
-                {
-                    fgIndex[i - 1] = args[1][i]; // Each character from args[1] is copied to fgIndex with an offset of -1
-                }
-                fgIndex[i - 1] = '\0';
-                pid_t pid = atoi(fgIndex);                    // Convert string fgIndex to integer
-                moveToForeground(pid, bgProcesses, &bgCount); // Move process to foreground
+                depth++;
             }
-            else
+            else if (isGroupClose(args[j]))
             {
-                printf("Usage: fg <pid>\n");
+                depth--;
             }
-            continue;
+            else if (depth == 0 && (strcmp(args[j], "&&") == 0 || strcmp(args[j], "||") == 0))
+            {
+                break;
+            }
+            j++;
         }
 
-        /* Add command to history */
-        addToHistory(args, historyBuffer, background);
+        if (j == i || (j < end && j + 1 == end))
+        {
+            fprintf(stderr, "Syntax error near '%s'\n", j < end ? args[j] : args[i]);
+            return 2;
+        }
 
-        /* Fork a child process */
-        pid_t pid = fork();
-        if (pid < 0)
+        if (run)
         {
-            fprintf(stderr, "Fork failed");
-            continue;
+            status = executePipeline(args, i, j, background, lastInPlace && j >= end);
+        }
+        if (j < end)
+        {
+            run = strcmp(args[j], "&&") == 0 ? status == 0 : status != 0; // Short-circuit
+        }
+        i = j + 1;
+    }
+    return status;
+}
+
+/*
+ * Runs a ( subshell ) or a { group }, each with optional redirections
+ * after it, or a single command or pipe. A group that is a pipe stage
+ * goes through the pipe like a command and runs in the stage's child.
+ */
+int executePipeline(char *args[], int start, int end, int background, int lastInPlace)
+{
+    int piped = 0;
+    for (int i = start, depth = 0; i < end; i++)
+    {
+        depth = groupDepth(args + start, i - start, depth);
+        piped |= depth == 0 && strcmp(args[i], "|") == 0;
+    }
+
+    if (isGroupOpen(args[start]) && !piped)
+    {
+        int close = findClosing(args, start, end);
+        if (close == -1 || args[start][0] != (args[close][0] == ')' ? '(' : '{'))
+        {
+            fprintf(stderr, "Syntax error: unmatched '%s'\n", args[start]);
+            return 2;
         }
 
-        if (pid == 0) // Only child process runs this block
+        /* Only redirections may follow the group, they apply to all of it */
+        char *rest[MAX_LINE / 2 + 1];
+        for (int i = close + 1; i < end; i++)
+        {
+            rest[i - close - 1] = args[i];
+        }
+        rest[end - close - 1] = NULL;
+        char **words = expandArguments(rest);
+        struct redirection list[MAX_REDIRECTIONS];
+        int saved[MAX_REDIRECTIONS];
+        int count = parseRedirections(words, list);
+        if (count < 0)
         {
-            /* Child process */
-            char fullPath[MAX_LINE] = {0};
-            findCommandPath(args[0], fullPath); // Find command path
+            return 2;
+        }
+        if (words[0] != NULL)
+        {
+            fprintf(stderr, "Syntax error near '%s'\n", words[0]);
+            return 2;
+        }
+        resolveAppends(list, count);
 
-            if (fullPath[0] == '\0')
+        /* Groups run in the shell unless they are backgrounded */
+        if (args[start][0] == '{' && !background)
+        {
+            if (count == 0)
             {
-                fprintf(stderr, "Command not found: %s\n", args[0]);
-                exit(1);
+                return executeList(args, start + 1, close, lastInPlace);
             }
+            int status = applyRedirections(list, count, saved) == 0 ? executeList(args, start + 1, close, 0) : 1;
+            restoreRedirections(list, count, saved);
+            return status;
+        }
+
+        /* Nothing follows the subshell, so the shell can be the subshell */
+        if (lastInPlace && !background)
+        {
+            return applyRedirections(list, count, NULL) == 0 ? executeList(args, start + 1, close, 1) : 1;
+        }
 
-            if (execv(fullPath, args) == -1)
+        pid_t pid = forkShell();
+        if (pid < 0)
+        {
+            fprintf(stderr, "Fork failed");
+            return 1;
+        }
+        if (pid == 0)
+        {
+            if (applyRedirections(list, count, NULL) < 0)
             {
-                fprintf(stderr, "Command execution failed");
                 exit(1);
             }
+            exit(executeList(args, start + 1, close, 1)); // Its last command execs in place
         }
-        else
+        if (background)
         {
-            /* Parent process */
-            if (background)
-            {
-                /* Run in background */
-                if (bgCount < MAX_BG_PROCESSES)
-                {
-                    bgProcesses[bgCount++] = pid; // Store background process ID
-                    printf("Process %d running in background\n", pid);
-                }
-                else
-                {
-                    fprintf(stderr, "Maximum background processes reached.\n");
-                }
-            }
-            else
-            {
-                /* Run in foreground */
-                fg_pid = pid;          // Set foreground process ID
-                waitpid(pid, NULL, 0); // Wait for child
-                fg_pid = -1;           // Reset foreground process ID
-            }
+            addBackground(pid);
+            return 0;
         }
+        return waitForeground(pid);
     }
 
-    return 0;
-}
-
-/* Parses the input line and populates args[] with the parsed components */
-void setup(char inputBuffer[], char *args[], int *background)
-{
-    int length, start = -1, ct = 0;
-    *background = 0; // Initialize background flag to 0, foreground execution
+    /* A simple command or pipe gets its own NULL terminated argument array */
+    char *cmd[MAX_LINE / 2 + 1];
+    for (int i = start; i < end; i++)
+    {
+        cmd[i - start] = args[i];
+    }
+    cmd[end - start] = NULL;
 
-    /* Read input */
-    length = read(STDIN_FILENO, inputBuffer, MAX_LINE);
-    if (length == 0)
-        exit(0); // End of input (Ctrl+D)
-    if (length < 0 && errno != EINTR)
+    /* Aliases become ordinary words of each pipe stage and take the normal spawn path */
+    if (expandAlias(cmd) == -1)
     {
-        fprintf(stderr, "Error reading the command");
-        exit(-1);
+        return 1;
     }
 
-    /* Parse inputBuffer */
-    for (int i = 0; i < length; i++)
+    int substitutions = procSubCount;
+    char **argv = expandArguments(cmd);
+    if (argv[0] == NULL)
     {
-        switch (inputBuffer[i])
-        {
-        case ' ':
-        case '\t':
-            if (start != -1)
-            {
-                args[ct++] = &inputBuffer[start]; // Add argument
-                inputBuffer[i] = '\0';            // Null-terminate
-                start = -1;
-            }
-            break;
-        case '\n':
-            if (start != -1)
-            {
-                args[ct++] = &inputBuffer[start];
-            }
-            inputBuffer[i] = '\0';
-            args[ct] = NULL; // Mark end of arguments
-            break;
-        case '&':
-            *background = 1; // Background execution
-            inputBuffer[i] = '\0';
-            break;
-        default:
-            if (start == -1)
-                start = i; // Start of new argument
-        }
+        closeSubstitutions(substitutions);
+        return 0; // Every word expanded to nothing
     }
 
-    args[ct] = NULL; // Ensure args ends with NULL
+    execInPlace = lastInPlace;
+    int status = executeCommand(argv, background);
+    execInPlace = 0;
+    closeSubstitutions(substitutions); // The command has its copies now
+    return status;
 }
 
-/* Finds the full path of the command */
-void findCommandPath(const char *command, char *fullPath)
+/* Runs a builtin, or NAME=value words on their own, in the shell */
+int executeBuiltin(char *args[])
 {
-    char *pathEnv = getenv("PATH"); // Retrieve PATH environment variable
-    if (!pathEnv)
+    char (*historyBuffer)[MAX_LINE] = shellHistory; // Command history
+
+    if (args[0] == NULL)
     {
-        fprintf(stderr, "PATH environment variable not found");
-        exit(1);
+        return 0; // Only redirections
     }
 
-    char *path = strtok(pathEnv, ":"); // Split PATH by ':'
-    while (path != NULL)
+    /* NAME=value alone sets shell variables, before a command it only sets them for the command */
+    int assignments = 0;
+    while (args[assignments] != NULL && assignmentLength(args[assignments]) > 0)
     {
-        snprintf(fullPath, MAX_LINE, "%s/%s", path, command); // Constructs a potential full path for the command by combining the current directory path and the command name.
-        if (access(fullPath, X_OK) == 0)                      // X_OK flag checks if the file is executable
+        assignments++;
+    }
+    if (assignments > 0 && args[assignments] == NULL)
+    {
+        for (int i = 0; i < assignments; i++)
         {
-            return; // Command found
+            setVariable(args[i], 0);
         }
-        path = strtok(NULL, ":"); // Moves to next directory path
+        return 0;
     }
 
-    fullPath[0] = '\0'; // Command not found
-}
-
-/* Executes a command from history */
-void executeFromHistory(char *historyLine, char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE])
-{
-    int background = 0;
-    int ct = 0, start = -1;
+    /* Built-in commands */
+    if (strcmp(args[0], "exit") == 0)
+    {
+        terminateProgram(bgCount, args[1] != NULL ? atoi(args[1]) : lastStatus); // Exit shell
+        return 1;
+    }
 
-    /* Parse historyLine */
-    int i;
-    for (i = 0; historyLine[i] != '\0'; i++)
+    if (strcmp(args[0], "history") == 0)
     {
-        switch (historyLine[i])
+        /* Handle history command */
+        if (args[1] == NULL)
         {
-        case ' ':
-        case '\t':
-            if (start != -1)
-            {
-                args[ct++] = &historyLine[start];
-                historyLine[i] = '\0'; // Null-terminate
-                start = -1;
+            printHistory(historyBuffer); // Print history
+            return 0;
+        }
+        if (args[1][0] != '-' || args[1][1] != 'i' || args[2] == NULL)
+        {
+            fprintf(stderr, "\"-i\" must be entered before the index.\n");
+            return 2;
+        }
+        int historyIndex = atoi(args[2]); // Get history index
+        if (historyIndex < 0 || historyIndex >= MAX_HISTORY)
+        {
+            fprintf(stderr, "Error: Invalid history index.\n");
+            return 1;
+        }
+        if (historyBuffer[historyIndex][0] == '\0')
+        {
+            fprintf(stderr, "Error: No such history entry.\n");
+            return 1;
+        }
+        char historyLine[MAX_LINE];
+        strncpy(historyLine, historyBuffer[historyIndex], MAX_LINE);
+        historyLine[MAX_LINE - 1] = '\0';
+        return executeFromHistory(historyLine, historyBuffer); // Execute history command
+    }
+
+    if (strcmp(args[0], "trace") == 0)
+    {
+        /* Start or stop tracing */
+        if (args[1] == NULL)
+        {
+            printf("Usage: trace <file> | trace off\n");
+            return 2;
+        }
+        if (strcmp(args[1], "off") == 0)
+        {
+            traceStop();
+        }
+        else
+        {
+            traceStart(args[1]);
+        }
+        return traceFd == -1 && strcmp(args[1], "off") != 0;
+    }
+
+    if (strcmp(args[0], "alias") == 0)
+    {
+        return aliasCommand(args);
+    }
+
+    if (strcmp(args[0], "unalias") == 0)
+    {
+        if (args[1] == NULL)
+        {
+            printf("Usage: unalias <name>\n");
+            return 2;
+        }
+        if (!removeAlias(args[1]))
+        {
+            fprintf(stderr, "unalias: %s not found\n", args[1]);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (strcmp(args[0], "export") == 0)
+    {
+        return exportCommand(args);
+    }
+
+    if (strcmp(args[0], "unset") == 0)
+    {
+        for (int i = 1; args[i] != NULL; i++)
+        {
+            unsetVariable(args[i]);
+        }
+        return 0;
+    }
+
+    if (strcmp(args[0], "copy") == 0 || strcmp(args[0], "cat") == 0)
+    {
+        return copyCommand(args);
+    }
+
+    if (strcmp(args[0], "tee") == 0)
+    {
+        return teeCommand(args);
+    }
+
+    if (strcmp(args[0], "wc") == 0)
+    {
+        return wcCommand(args);
+    }
+
+    if (strcmp(args[0], "grep") == 0)
+    {
+        return grepCommand(args);
+    }
+
+    if (strcmp(args[0], "sort") == 0)
+    {
+        return sortCommand(args);
+    }
+
+    if (strcmp(args[0], "stats") == 0)
+    {
+        /* Print or export the metrics */
+        if (args[1] == NULL)
+        {
+            statsPrint(stdout, 0);
+        }
+        else if (strcmp(args[1], "prom") == 0)
+        {
+            statsPrint(stdout, 1);
+        }
+        else if (strcmp(args[1], "file") == 0 && args[2] != NULL)
+        {
+            free(statsFile);
+            statsFile = strdup(args[2]);
+            if (args[3] != NULL && atoi(args[3]) > 0)
+            {
+                statsInterval = atoi(args[3]);
+            }
+            statsExport(1);
+        }
+        else if (strcmp(args[1], "off") == 0)
+        {
+            free(statsFile);
+            statsFile = NULL;
+        }
+        else
+        {
+            printf("Usage: stats [prom | file <path> [seconds] | off]\n");
+            return 2;
+        }
+        return 0;
+    }
+
+    if (strcmp(args[0], "fg") == 0)
+    {
+        /* Bring background process to foreground */
+        if (args[1] != NULL)
+        {
+            if (args[1][0] != '%') /* Check syntax usage */
+            {
+                fprintf(stderr, "Use fg with correct syntax.\n");
+                return 2;
+            }
+            pid_t pid = atoi(args[1] + 1);                       // Number after the %
+            return moveToForeground(pid, bgProcesses, &bgCount); // Move process to foreground
+        }
+        printf("Usage: fg <pid>\n");
+        return 2;
+    }
+
+    return 1; // isBuiltin() and this list disagree
+}
+
+/* Tells if args[] runs in the shell: a builtin, only NAME=value words or only redirections */
+int isBuiltin(char *args[])
+{
+    static const char *builtins[] = {"exit", "history", "trace", "alias", "unalias", "export", "unset", "stats", "fg", "copy", NULL};
+
+    if (args[0] == NULL)
+    {
+        return 1;
+    }
+    if (strcmp(args[0], "grep") == 0)
+    {
+        return grepSupported(args); // Other options are left to grep(1)
+    }
+    if (strcmp(args[0], "sort") == 0)
+    {
+        return sortSupported(args);
+    }
+    if (strcmp(args[0], "tee") == 0)
+    {
+        return teeSupported(args);
+    }
+    if (strcmp(args[0], "wc") == 0)
+    {
+        return wcSupported(args);
+    }
+    if (assignmentLength(args[0]) > 0)
+    {
+        return commandName(args)[0] == '\0';
+    }
+    for (int i = 0; builtins[i] != NULL; i++)
+    {
+        if (strcmp(args[0], builtins[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Runs a simple command or a pipe and returns its exit status */
+int executeCommand(char *args[], int background)
+{
+    int status = 0;
+
+    /* Check for pipes, a | inside a group stage belongs to the group */
+    int hasPipe = 0;
+    for (int i = 0, depth = 0; args[i] != NULL && !hasPipe; i++)
+    {
+        depth = groupDepth(args, i, depth);
+        hasPipe = depth == 0 && strcmp(args[i], "|") == 0;
+    }
+
+    if (hasPipe)
+    {
+        /* Handle piped commands */
+        return executePipedCommands(args, background);
+    }
+
+    /* Redirections come out of the words and are applied in one pass */
+    struct redirection redirections[MAX_REDIRECTIONS];
+    int saved[MAX_REDIRECTIONS];
+    int redirectionCount = parseRedirections(args, redirections);
+    if (redirectionCount < 0)
+    {
+        return 2;
+    }
+    resolveAppends(redirections, redirectionCount);
+
+    /* Builtins and assignments run in the shell, their redirections are undone afterwards */
+    if (isBuiltin(args) || catToFile(args, redirections, redirectionCount))
+    {
+        status = applyRedirections(redirections, redirectionCount, saved) == 0 ? executeBuiltin(args) : 1;
+        restoreRedirections(redirections, redirectionCount, saved);
+        return status;
+    }
+
+    /* Fork a child process */
+    pid_t pid = forkUnlessLast(commandName(args), background);
+    if (pid < 0)
+    {
+        fprintf(stderr, "Fork failed");
+        return 1;
+    }
+
+    if (pid == 0) // Only child process runs this block
+    {
+        /* Child process */
+        if (applyRedirections(redirections, redirectionCount, NULL) < 0)
+        {
+            exit(1);
+        }
+        execCommand(args); // Find the command and exec it
+    }
+
+    /* Parent process */
+    if (background)
+    {
+        addBackground(pid); // Run in background
+        return 0;
+    }
+    return waitForeground(pid); // Run in foreground
+}
+
+/* Parses the input line and populates args[] with the parsed components */
+void setup(char inputBuffer[], char *args[])
+{
+    int length;
+
+    /* Read a line, leaving room for the terminating NUL */
+    length = readInput(inputBuffer, MAX_LINE - 1);
+    if (length == 0)
+    {
+        snapshotSave(1);
+        statsExport(1);
+        traceStop();
+        exit(lastStatus); // End of input (Ctrl+D)
+    }
+    if (length < 0 && errno != EINTR)
+    {
+        fprintf(stderr, "Error reading the command");
+        exit(-1);
+    }
+    traceEvent("line read", 'i', nowMicros(), 0, NULL);
+    recordLine(inputBuffer, length);
+
+    arenaReset(); // The previous line is done with its expansions
+    parseLine(inputBuffer, length, args);
+    collectHereDocs(args);
+}
+
+/* Splits the first length bytes of inputBuffer into words and operator tokens; inputBuffer needs room for one more byte */
+void parseLine(char inputBuffer[], int length, char *args[])
+{
+    int start = -1, ct = 0;
+    double parseStart = nowMicros();
+
+    /* Parse inputBuffer */
+    for (int i = 0; i < length && ct < MAX_LINE / 2 - 2; i++)
+    {
+        char c = inputBuffer[i];
+        switch (c)
+        {
+        case ' ':
+        case '\t':
+        case '\n':
+            if (start != -1)
+            {
+                args[ct++] = &inputBuffer[start]; // Add argument
+                start = -1;
             }
+            inputBuffer[i] = '\0'; // Null-terminate
             break;
         case '&':
-            background = 1;
-            historyLine[i] = '\0'; 
+            if ((start != -1 && (inputBuffer[i - 1] == '>' || inputBuffer[i - 1] == '<')) ||
+                (start == -1 && i + 1 < length && inputBuffer[i + 1] == '>'))
+            {
+                /* Part of a redirection: 2>&1, <&3, &> file */
+                if (start == -1)
+                    start = i;
+                break;
+            }
+            /* fall through */
+        case '|':
+            if (c == '|' && start != -1 && inputBuffer[i - 1] == '>')
+            {
+                break; // >| file
+            }
+            /* fall through */
+        case ';':
+        case '(':
+        case ')':
+            /* Operators end the current word and become tokens of their own */
+            if (start != -1)
+            {
+                args[ct++] = &inputBuffer[start];
+                start = -1;
+            }
+            inputBuffer[i] = '\0';
+            if ((c == '&' || c == '|') && i + 1 < length && inputBuffer[i + 1] == c)
+            {
+                args[ct++] = c == '&' ? "&&" : "||";
+                inputBuffer[++i] = '\0';
+            }
+            else
+            {
+                args[ct++] = c == ';' ? ";" : c == '&' ? "&" : c == '|' ? "|" : c == '(' ? "(" : ")";
+            }
             break;
-        default:
+        case '<':
+        case '>':
+            if (i + 1 < length && inputBuffer[i + 1] == '(')
+            {
+                /* <(...) and >(...) are one word, blanks and operators included */
+                int end = substitutionEnd(inputBuffer, i, length);
+                if (end != -1)
+                {
+                    if (start == -1)
+                        start = i;
+                    i = end;
+                    break;
+                }
+            }
+            if (start != -1)
+            {
+                /* 2>, >> and &> stay one word, any other word ends at the operator */
+                int k = start;
+                while (k < i && inputBuffer[k] >= '0' && inputBuffer[k] <= '9')
+                {
+                    k++;
+                }
+                if (k == i || inputBuffer[i - 1] == '>' || inputBuffer[i - 1] == '<' ||
+                    (i == start + 1 && inputBuffer[start] == '&'))
+                {
+                    break;
+                }
+                args[ct++] = &inputBuffer[start];
+                start = -1;
+                inputBuffer[i] = '\0';
+                if (c == '>' && i + 1 < length && inputBuffer[i + 1] == '>')
+                {
+                    args[ct++] = ">>";
+                    i++;
+                    break;
+                }
+                if (i + 1 < length && inputBuffer[i + 1] == '&')
+                {
+                    args[ct++] = c == '>' ? ">&" : "<&";
+                    i++;
+                    break;
+                }
+                if (c == '>' || i + 1 >= length || inputBuffer[i + 1] != '<')
+                {
+                    args[ct++] = c == '>' ? ">" : "<";
+                    break;
+                }
+            }
+            if (c == '<' && i + 1 < length && inputBuffer[i + 1] == '<')
+            {
+                /* <<, <<- and <<< are tokens even when the word follows without a blank */
+                if (i + 2 < length && inputBuffer[i + 2] == '<')
+                {
+                    args[ct++] = "<<<";
+                    i += 2;
+                }
+                else if (i + 2 < length && inputBuffer[i + 2] == '-')
+                {
+                    args[ct++] = "<<-";
+                    i += 2;
+                }
+                else
+                {
+                    args[ct++] = "<<";
+                    i += 1;
+                }
+                break;
+            }
             if (start == -1)
                 start = i;
+            break;
+        case '#':
+            if (start == -1)
+            {
+                length = i; // Comment up to the end of the line
+                break;
+            }
+            /* fall through */
+        default:
+            if (start == -1)
+                start = i; // Start of new argument
+            if ((c == '$' && i + 1 < length && inputBuffer[i + 1] == '(') || c == '`')
+            {
+                /* A command substitution stays in the word, blanks and operators included */
+                int end = substitutionEnd(inputBuffer, i, length);
+                if (end != -1)
+                    i = end;
+            }
+        }
+    }
+
+    /* Last word of a line without a newline (-c and the end of a script) */
+    if (start != -1)
+    {
+        inputBuffer[length] = '\0';
+        args[ct++] = &inputBuffer[start];
+    }
+
+    args[ct] = NULL; // Ensure args ends with NULL
+    traceEvent("parse", 'X', parseStart, nowMicros(), args[0]);
+}
+
+/* FNV-1a hash shared by the path cache and the alias table */
+unsigned stringHash(const char *text)
+{
+    unsigned hash = 2166136261u;
+    for (; *text != '\0'; text++)
+    {
+        hash = (hash ^ (unsigned char)*text) * 16777619u;
+    }
+    return hash;
+}
+
+/* Finds the full path of the command, remembering the answer for the next lookup */
+void findCommandPath(const char *command, char *fullPath)
+{
+    double start = nowMicros();
+    fullPath[0] = '\0';
+
+    if (strchr(command, '/') != NULL)
+    {
+        /* Relative or absolute path, PATH is not searched */
+        if (access(command, X_OK) == 0)
+            snprintf(fullPath, MAX_LINE, "%s", command);
+        traceEvent("path lookup", 'X', start, nowMicros(), command);
+        return;
+    }
+
+    char *pathEnv = getVariable("PATH"); // Retrieve PATH, exported or not
+    if (!pathEnv)
+    {
+        fprintf(stderr, "PATH environment variable not found\n");
+        return;
+    }
+
+    /* A different PATH invalidates every cached answer */
+    if (pathCacheEnv == NULL || strcmp(pathCacheEnv, pathEnv) != 0)
+    {
+        memset(pathCache, 0, PATH_CACHE_SIZE * sizeof(struct pathEntry));
+        free(pathCacheEnv);
+        pathCacheEnv = strdup(pathEnv);
+    }
+
+    /* Linear probing from the home slot */
+    unsigned slot = stringHash(command) % PATH_CACHE_SIZE;
+    struct pathEntry *entry = NULL;
+    for (int probe = 0; probe < PATH_CACHE_SIZE; probe++)
+    {
+        struct pathEntry *candidate = &pathCache[(slot + probe) % PATH_CACHE_SIZE];
+        if (candidate->command[0] == '\0' || strcmp(candidate->command, command) == 0)
+        {
+            entry = candidate;
+            break;
+        }
+    }
+    if (entry == NULL)
+    {
+        entry = &pathCache[slot]; // Table is full, replace the home slot
+        entry->command[0] = '\0';
+    }
+
+    /* A hit costs one access() instead of one per PATH directory */
+    if (entry->command[0] != '\0' && access(entry->fullPath, X_OK) == 0)
+    {
+        STAT_ADD(pathHits, 1);
+        strcpy(fullPath, entry->fullPath);
+        traceEvent("path lookup", 'X', start, nowMicros(), command);
+        return;
+    }
+    STAT_ADD(pathMisses, 1);
+
+    char pathCopy[4096];
+    snprintf(pathCopy, sizeof(pathCopy), "%s", pathEnv); // strtok must not modify the environment
+    char *saveptr;
+    char *path = strtok_r(pathCopy, ":", &saveptr); // Split PATH by ':'
+    while (path != NULL)
+    {
+        snprintf(fullPath, MAX_LINE, "%s/%s", path, command); // Constructs a potential full path for the command by combining the current directory path and the command name.
+        if (access(fullPath, X_OK) == 0)                      // X_OK flag checks if the file is executable
+        {
+            snprintf(entry->command, MAX_LINE, "%s", command);
+            strcpy(entry->fullPath, fullPath);
+            traceEvent("path lookup", 'X', start, nowMicros(), command);
+            return; // Command found
+        }
+        path = strtok_r(NULL, ":", &saveptr); // Moves to next directory path
+    }
+
+    fullPath[0] = '\0'; // Command not found
+    traceEvent("path lookup", 'X', start, nowMicros(), command);
+}
+
+/* Executes a command from history */
+int executeFromHistory(char *historyLine, char historyBuffer[MAX_HISTORY][MAX_LINE])
+{
+    char *args[MAX_LINE / 2 + 1];
+    int count = 0;
+
+    /* Parse historyLine */
+    parseLine(historyLine, strlen(historyLine), args);
+    while (args[count] != NULL)
+    {
+        count++;
+    }
+
+    if (args[0] == NULL)
+    {
+        fprintf(stderr, "Error: Invalid command in history.\n");
+        return 1;
+    }
+
+    addToHistory(args, historyBuffer); // Add to history
+    return executeList(args, 0, count, 0);
+}
+
+/* Adds a command to the history buffer */
+void addToHistory(char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE])
+{
+    char inputBuffer[MAX_LINE] = {0};
+
+    if (!interactive)
+    {
+        return; // Scripts keep no history
+    }
+
+    /* Reconstruct the command */
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        strcat(inputBuffer, args[i]);
+        if (args[i + 1] != NULL)
+        {
+            strcat(inputBuffer, " ");
+        }
+    }
+
+    /* Shift history */
+    for (int i = MAX_HISTORY - 1; i > 0; i--)
+    {
+        strncpy(historyBuffer[i], historyBuffer[i - 1], MAX_LINE);
+    }
+
+    /* Add new command */
+    strncpy(historyBuffer[0], inputBuffer, MAX_LINE);
+}
+
+/* Prints the command history */
+void printHistory(char historyBuffer[MAX_HISTORY][MAX_LINE])
+{
+    for (int i = 0; i < MAX_HISTORY; i++)
+    {
+        if (historyBuffer[i][0] != '\0')
+        {
+            printf("%d. %s\n", i, historyBuffer[i]);
+        }
+    }
+}
+
+/* Brings a background process to the foreground */
+int moveToForeground(pid_t pid, pid_t bgProcesses[MAX_BG_PROCESSES], int *bgCount)
+{
+    int found = 0, status = 0;
+    for (int i = 0; i < *bgCount; i++)
+    {
+        if (bgProcesses[i] == pid)
+        {
+            found = 1;
+            status = waitForeground(pid); // Wait for process
+            /* Remove from background processes */
+            for (int j = i; j < *bgCount - 1; j++)
+            {
+                bgProcesses[j] = bgProcesses[j + 1];
+            }
+            (*bgCount)--;
+            break;
+        }
+    }
+    if (!found)
+    {
+        printf("Process with PID %d not found in background processes.\n", pid);
+        return 1;
+    }
+    return status;
+}
+
+/* Executes piped commands: any number of stages, each with its own redirections */
+int executePipedCommands(char *args[], int background)
+{
+    char **stages[MAX_STAGES];
+    struct redirection redirections[MAX_STAGES][MAX_REDIRECTIONS + 1]; // One more for a stage run in the shell
+    int redirectionCounts[MAX_STAGES];
+    pid_t pids[MAX_STAGES];
+    int stageCount = 0;
+
+    /* Split the words at each | outside a group in place */
+    stages[stageCount++] = args;
+    for (int i = 0, depth = 0; args[i] != NULL; i++)
+    {
+        depth = groupDepth(args, i, depth);
+        if (depth != 0 || strcmp(args[i], "|") != 0)
+        {
+            continue;
+        }
+        if (stageCount == MAX_STAGES)
+        {
+            fprintf(stderr, "Too many commands in the pipe.\n");
+            return 1;
+        }
+        args[i] = NULL;
+        stages[stageCount++] = &args[i + 1];
+    }
+
+    for (int i = 0; i < stageCount; i++)
+    {
+        /* A group stage takes its own redirections in its child, inner ones are not the stage's */
+        redirectionCounts[i] = stages[i][0] != NULL && isGroupOpen(stages[i][0]) ? 0 : parseRedirections(stages[i], redirections[i]);
+        if (redirectionCounts[i] < 0)
+        {
+            return 2;
+        }
+        if (stages[i][0] == NULL)
+        {
+            fprintf(stderr, "Syntax error near '|'\n");
+            return 2;
+        }
+    }
+
+    /* Input files of the first stage are opened here, once, and handed over as descriptors */
+    for (int i = 0; i < redirectionCounts[0]; i++)
+    {
+        struct redirection *r = &redirections[0][i];
+        if (r->kind == REDIRECT_FILE && r->fd == STDIN_FILENO)
+        {
+            int fd = open(r->target, r->flags | O_CLOEXEC);
+            if (fd < 0)
+            {
+                fprintf(stderr, "Error opening %s: %s\n", r->target, strerror(errno));
+                for (int j = 0; j < i; j++)
+                {
+                    if (redirections[0][j].kind == REDIRECT_OPENED)
+                        close(redirections[0][j].source);
+                }
+                return 1;
+            }
+            r->kind = REDIRECT_OPENED;
+            r->source = fd;
+        }
+    }
+    for (int i = 0; i < stageCount; i++)
+    {
+        resolveAppends(redirections[i], redirectionCounts[i]);
+    }
+
+    /* A grep or wc at the end of a foreground pipe reads it in the shell instead of a child */
+    int last = stageCount - 1;
+    int inShell = !background && ((strcmp(stages[last][0], "grep") == 0 && grepSupported(stages[last])) ||
+                                  (strcmp(stages[last][0], "wc") == 0 && wcSupported(stages[last])));
+
+    /* pipestat puts a meter process on every pipe of a foreground pipe */
+    struct pipeMeter *meters = NULL;
+    pid_t meterPids[MAX_STAGES];
+    int meterCount = 0;
+    if (pipestatMode && !background && stageCount > 1)
+    {
+        meters = mmap(NULL, MAX_STAGES * sizeof(struct pipeMeter), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (meters == MAP_FAILED)
+        {
+            fprintf(stderr, "pipestat: %s\n", strerror(errno));
+            meters = NULL;
+        }
+    }
+
+    int input = -1; // Read end of the previous stage's pipe
+    int started = 0;
+    for (int i = 0; i < stageCount - inShell; i++)
+    {
+        int pipefd[2] = {-1, -1};
+        if (i + 1 < stageCount && pipe2(pipefd, O_CLOEXEC) == -1)
+        {
+            fprintf(stderr, "Pipe creation failed");
+            break;
+        }
+
+        int group = isGroupOpen(stages[i][0]);
+        pids[i] = group ? forkShell() : forkCommand(commandName(stages[i]));
+        if (pids[i] == 0)
+        {
+            /* Stage i reads the previous pipe and writes the next one */
+            if (input != -1)
+            {
+                dup2(input, STDIN_FILENO);
+                close(input);
+            }
+            if (pipefd[1] != -1)
+            {
+                connectStage(pipefd, STDOUT_FILENO);
+            }
+
+            if (traceFd != -1 && i > 0)
+            {
+                /* Mark when the producer's first byte reaches the pipe */
+                struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+                while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+                    ;
+                traceEvent("first byte", 'i', nowMicros(), 0, stages[i][0]);
+            }
+
+            if (applyRedirections(redirections[i], redirectionCounts[i], NULL) < 0)
+            {
+                exit(1);
+            }
+            if (group)
+            {
+                int words = 0;
+                while (stages[i][words] != NULL)
+                {
+                    words++;
+                }
+                exit(executePipeline(stages[i], 0, words, 0, 1));
+            }
+            if (strcmp(stages[i][0], "copy") == 0 ||
+                (strcmp(stages[i][0], "tee") == 0 && teeSupported(stages[i])) ||
+                (strcmp(stages[i][0], "wc") == 0 && wcSupported(stages[i])) ||
+                (strcmp(stages[i][0], "grep") == 0 && grepSupported(stages[i])) ||
+                (strcmp(stages[i][0], "sort") == 0 && sortSupported(stages[i])))
+            {
+                exit(executeBuiltin(stages[i])); // I/O builtins need no shell state, so they run in the stage's child
+            }
+            execCommand(stages[i]);
+        }
+
+        /* Parent process */
+        if (input != -1)
+        {
+            close(input);
+        }
+        input = pipefd[0];
+        if (pipefd[1] != -1)
+        {
+            close(pipefd[1]);
+        }
+        if (pids[i] < 0)
+        {
+            fprintf(stderr, "Fork failed");
+            break;
+        }
+        started++;
+        if (meters != NULL && input != -1)
+        {
+            input = startMeter(input, &meters[i], &meterPids[i]);
+            meterCount = i + 1;
+        }
+    }
+    for (int i = 0; i < redirectionCounts[0]; i++)
+    {
+        if (redirections[0][i].kind == REDIRECT_OPENED)
+        {
+            close(redirections[0][i].source); // The first stage has its copy
+        }
+    }
+
+    int status = 1, shellStatus = 1;
+    if (inShell && started == last && input != -1)
+    {
+        /* The pipe goes onto stdin first, so the stage's own < still wins */
+        struct redirection *list = redirections[last];
+        int saved[MAX_REDIRECTIONS + 1];
+        memmove(&list[1], &list[0], redirectionCounts[last] * sizeof(struct redirection));
+        list[0] = (struct redirection){REDIRECT_DUP, STDIN_FILENO, 0, input, "|", NULL};
+        shellStatus = applyRedirections(list, redirectionCounts[last] + 1, saved) == 0 ? executeBuiltin(stages[last]) : 1;
+        restoreRedirections(list, redirectionCounts[last] + 1, saved);
+    }
+    int consumerGone = 0;
+    if (input != -1)
+    {
+        /* Without POLLHUP the writers are still there, so the builtin stopped early, like grep -q */
+        struct pollfd pfd = {input, POLLIN, 0};
+        consumerGone = inShell && poll(&pfd, 1, 0) >= 0 && !(pfd.revents & POLLHUP);
+        close(input);
+    }
+
+    for (int i = 0; background && i < started; i++)
+    {
+        addBackground(pids[i]);
+        status = 0;
+    }
+    if (!background && started > 0)
+    {
+        /* Stages whose stdout is redirected do not write into the pipe, so a reader's exit does not stop them */
+        int piped[MAX_STAGES];
+        for (int i = 0; i < started; i++)
+        {
+            piped[i] = 1;
+            for (int j = 0; j < redirectionCounts[i]; j++)
+            {
+                piped[i] &= redirections[i][j].fd != STDOUT_FILENO;
+            }
+        }
+        status = waitPipeline(pids, started, consumerGone, piped); // The pipe's status is the last command's
+    }
+    if (meters != NULL)
+    {
+        for (int i = 0; i < meterCount; i++)
+        {
+            if (meterPids[i] > 0)
+                waitForeground(meterPids[i]); // Done once their producer is
+        }
+        pipestatReport(meters, meterCount, stages);
+        munmap(meters, MAX_STAGES * sizeof(struct pipeMeter));
+    }
+    if (inShell)
+    {
+        return started == last ? shellStatus : 1;
+    }
+    return started == stageCount ? status : 1;
+}
+
+/* Handles SIGTSTP (Ctrl+Z) */
+void handleSigTSTP(int sig)
+{
+    if (fg_pid != -1)
+    {
+        printf("\nCaught SIGTSTP (Ctrl+Z). Terminating foreground process %d and its descendants.\n", fg_pid);
+        kill(fg_pid, SIGTERM); // Terminate FG process
+    }
+    else
+    {
+        fprintf(stderr, "\nNo foreground process to terminate.\n");
+        return;
+    }
+}
+
+/* Exits the shell, the prompt refuses while jobs run but -c and scripts always exit */
+void terminateProgram(int bgCount, int status)
+{
+    if (bgCount != 0 && interactive)
+    {
+        printf("There are still background processes running!\n");
+        return;
+    }
+    else
+    {
+        if (interactive)
+            printf("Exiting shell...\n");
+        snapshotSave(1);
+        statsExport(1);
+        traceStop();
+        exit(status);
+    }
+}
+
+/* Handles SIGCHLD (child termination) */
+void handleSigCHLD(int sig)
+{
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) 
+    // WNOHANG: This flag tells waitpid or wait to return immediately if no child process has exited, rather than blocking the calling process.
+    {
+        childReaped(pid); // Counters and trace of background and pipeline processes
+
+        /* Remove terminated process from background processes */
+        int background = 0;
+        for (int i = 0; i < bgCount; i++)
+        {
+            if (bgProcesses[i] == pid)
+            {
+                for (int j = i; j < bgCount - 1; j++)
+                {
+                    bgProcesses[j] = bgProcesses[j + 1];
+                }
+                bgCount--;
+                STAT_ADD(bgReaped, 1);
+                background = 1;
+                break;
+            }
+        }
+        if (!background)
+        {
+            rememberReaped(pid, status); // A foreground wait may still want it
+        }
+    }
+}
+
+/* Keeps a status reaped by the handler so waitForeground() can still find it */
+void rememberReaped(pid_t pid, int status)
+{
+    reapedPids[reapedNext] = pid;
+    reapedStatus[reapedNext] = status;
+    reapedNext = (reapedNext + 1) % REAPED_SLOTS;
+}
+
+/* Fetches and forgets a status reaped by the handler, returns 0 if it is not there */
+int takeReaped(pid_t pid, int *status)
+{
+    for (int i = 0; i < REAPED_SLOTS; i++)
+    {
+        if (reapedPids[i] == pid)
+        {
+            reapedPids[i] = 0;
+            *status = reapedStatus[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Converts a waitpid() status into a shell exit status */
+int exitStatus(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+/* Waits for a foreground child and returns its exit status */
+int waitForeground(pid_t pid)
+{
+    int status = 0;
+    pid_t reaped;
+
+    fg_pid = pid;
+    while ((reaped = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+        ;
+    fg_pid = -1;
+
+    if (reaped == pid)
+    {
+        childReaped(pid);
+    }
+    else if (!takeReaped(pid, &status))
+    {
+        return 1; // Already collected elsewhere, status lost
+    }
+    return exitStatus(status);
+}
+
+/*
+ * Waits for the stages of a foreground pipe in the order they finish,
+ * watching a pidfd per stage. When a stage exits early, like head, the
+ * pipe it read has no reader left, so the stage writing into it is sent
+ * SIGPIPE at once instead of running on until its next write. That only
+ * happens if the writer's stdout is still the pipe (piped[]) and it has
+ * written something, so `sleep 2 | true` still takes 2 seconds and a
+ * stage with > on its stdout is never stopped. A writer that dies of it
+ * stops the stage before it the same way. consumerGone means the last
+ * stage ran in the shell and stopped reading early. Without pidfds the
+ * stages are waited for one after the other. Returns the status of the
+ * last stage.
+ */
+int waitPipeline(pid_t pids[], int count, int consumerGone, const int piped[])
+{
+    int status = 1;
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+    int fds[MAX_STAGES], done[MAX_STAGES] = {0};
+    int opened = 0;
+    for (; opened < count; opened++)
+    {
+        fds[opened] = syscall(SYS_pidfd_open, pids[opened], 0);
+        if (fds[opened] < 0 && errno != ESRCH)
+        {
+            break; // No pidfds, ESRCH only means the handler reaped it already
+        }
+    }
+
+    int left = opened == count ? count : 0;
+    if (left > 0 && consumerGone && piped[count - 1])
+    {
+        stopWriter(pids[count - 1], fds[count - 1]);
+    }
+    while (left > 0)
+    {
+        struct pollfd pfds[MAX_STAGES];
+        int stage[MAX_STAGES], polled = 0, gone = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (!done[i])
+            {
+                gone |= fds[i] < 0;
+                pfds[polled] = (struct pollfd){fds[i], POLLIN, 0}; // Negative fds are skipped by poll()
+                stage[polled++] = i;
+            }
+        }
+        fg_pid = pids[stage[polled - 1]];
+        if (!gone && poll(pfds, polled, -1) < 0)
+        {
+            continue; // EINTR from SIGCHLD
+        }
+        fg_pid = -1;
+
+        for (int k = 0; k < polled; k++)
+        {
+            int i = stage[k];
+            if (fds[i] >= 0 && !(pfds[k].revents & (POLLIN | POLLHUP)))
+            {
+                continue;
+            }
+            int result = waitForeground(pids[i]);
+            if (i == count - 1)
+            {
+                status = result;
+            }
+            if (fds[i] >= 0)
+            {
+                close(fds[i]);
+            }
+            done[i] = 1;
+            left--;
+            if (i > 0 && !done[i - 1] && piped[i - 1] && fds[i - 1] >= 0)
+            {
+                stopWriter(pids[i - 1], fds[i - 1]);
+            }
+        }
+    }
+    fg_pid = -1;
+    if (opened == count)
+    {
+        return status;
+    }
+    for (int i = 0; i < opened; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+#endif
+    if (consumerGone && piped[count - 1])
+    {
+        stopWriter(pids[count - 1], -1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        status = waitForeground(pids[i]);
+    }
+    return status;
+}
+
+/*
+ * Sends SIGPIPE to a stage whose reader exited, through its pidfd when
+ * there is one, if /proc says it has written anything yet. Returns 1 if
+ * the signal was sent.
+ */
+int stopWriter(pid_t pid, int pidfd)
+{
+    char path[64], text[512];
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        ssize_t n = read(fd, text, sizeof(text) - 1);
+        close(fd);
+        text[n > 0 ? n : 0] = '\0';
+        char *wchar = strstr(text, "wchar: ");
+        if (wchar != NULL && strtoull(wchar + 7, NULL, 10) == 0)
+        {
+            return 0; // Nothing written, it may never write
+        }
+    }
+
+    int sent;
+#if defined(SYS_pidfd_send_signal)
+    sent = pidfd >= 0 ? syscall(SYS_pidfd_send_signal, pidfd, SIGPIPE, NULL, 0) == 0 : kill(pid, SIGPIPE) == 0;
+#else
+    sent = kill(pid, SIGPIPE) == 0;
+#endif
+    if (sent)
+    {
+        STAT_ADD(pipeSignals, 1);
+    }
+    return sent;
+}
+
+/* Registers a background job */
+void addBackground(pid_t pid)
+{
+    if (bgCount < MAX_BG_PROCESSES)
+    {
+        bgProcesses[bgCount++] = pid; // Store background process ID
+        STAT_ADD(bgStarted, 1);
+        printf("Process %d running in background\n", pid);
+    }
+    else
+    {
+        fprintf(stderr, "Maximum background processes reached.\n");
+    }
+}
+
+/* Forks a subshell for a group or a backgrounded list */
+pid_t forkShell(void)
+{
+    fflush(NULL); // Don't let the child repeat buffered output
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        bgCount = 0;     // The parent's jobs are not ours
+        interactive = 0; // No prompts, history or snapshot in a subshell
+        return 0;
+    }
+    if (pid > 0)
+    {
+        STAT_ADD(forks, 1);
+        traceEvent("fork", 'i', nowMicros(), 0, "subshell");
+    }
+    return pid;
+}
+
+
+/* Removes a leading prefix word like "perfstat" from args[] and reports whether it was present */
+int stripPrefix(char *args[], const char *word)
+{
+    if (args[0] == NULL || strcmp(args[0], word) != 0)
+    {
+        return 0;
+    }
+
+    int i;
+    for (i = 0; args[i + 1] != NULL; i++)
+    {
+        args[i] = args[i + 1]; // Shift the real command to the front
+    }
+    args[i] = NULL;
+    return 1;
+}
+
+/* Creates the pipe a profiled child blocks on until its counters exist */
+void perfBeforeFork(void)
+{
+    if (!perfstatMode)
+    {
+        return;
+    }
+    if (pipe2(perfSync, O_CLOEXEC) == -1)
+    {
+        fprintf(stderr, "perfstat: pipe creation failed\n");
+        perfSync[0] = perfSync[1] = -1;
+    }
+}
+
+/* Child side: wait for the parent to attach counters, then continue to exec */
+void perfChildWait(void)
+{
+    if (perfSync[0] == -1)
+    {
+        return;
+    }
+
+    char c;
+    close(perfSync[1]);
+    while (read(perfSync[0], &c, 1) < 0 && errno == EINTR) // EOF means the counters are attached
+        ;
+    close(perfSync[0]);
+}
+
+/* Parent side: open the counters on the child and release it */
+void perfAttach(pid_t pid, const char *name)
+{
+    static const struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_EVENTS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+
+    if (perfSync[0] == -1)
+    {
+        return;
+    }
+
+    struct perfSlot *slot = NULL;
+    for (int i = 0; i < MAX_PERF_SLOTS; i++)
+    {
+        if (perfSlots[i].pid == 0)
+        {
+            slot = &perfSlots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL)
+    {
+        fprintf(stderr, "perfstat: too many profiled processes, %s is not counted\n", name);
+    }
+    else
+    {
+        for (int i = 0; i < PERF_EVENTS; i++)
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].type;
+            attr.config = events[i].config;
+            attr.disabled = 1;       // Start counting at exec, not during the handshake
+            attr.enable_on_exec = 1;
+            attr.inherit = 1;        // Include the children of the command
+            attr.exclude_kernel = 1; // Allowed with the default perf_event_paranoid
+            attr.exclude_hv = 1;
+            slot->fds[i] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        strncpy(slot->name, name, sizeof(slot->name) - 1);
+        slot->name[sizeof(slot->name) - 1] = '\0';
+        slot->pid = pid;
+    }
+
+    close(perfSync[1]); // Releases the child
+    close(perfSync[0]);
+    perfSync[0] = perfSync[1] = -1;
+}
+
+/* Prints and releases the counters of a reaped child, can be called from the SIGCHLD handler */
+void perfReport(pid_t pid)
+{
+    static const char *names[PERF_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses", "page-faults"};
+    sigset_t block, saved;
+
+    /* The handler and the foreground wait must not report the same slot twice */
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &saved);
+
+    for (int i = 0; i < MAX_PERF_SLOTS; i++)
+    {
+        if (perfSlots[i].pid != pid || pid <= 0)
+        {
+            continue;
+        }
+
+        char report[512];
+        int len = snprintf(report, sizeof(report), "\n Performance counter stats for '%s' (pid %d):\n", perfSlots[i].name, pid);
+        for (int j = 0; j < PERF_EVENTS; j++)
+        {
+            uint64_t value;
+            int fd = perfSlots[i].fds[j];
+            if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value))
+            {
+                len += snprintf(report + len, sizeof(report) - len, "%20llu      %s\n", (unsigned long long)value, names[j]);
+            }
+            else
+            {
+                len += snprintf(report + len, sizeof(report) - len, "%20s      %s\n", "<not supported>", names[j]);
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        write(STDERR_FILENO, report, len); // write() is safe inside the signal handler
+        perfSlots[i].pid = 0;
+        break;
+    }
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+/*
+ * Forks a pipestat meter that splices the pipe read by input into a new
+ * one and returns the new read end for the next stage. The meter is a
+ * plain child rather than a thread, so later stages forked by the shell
+ * do not inherit its ends. Returns input unchanged, with *pid at -1, if
+ * the meter cannot be started.
+ */
+int startMeter(int input, struct pipeMeter *meter, pid_t *pid)
+{
+    int pipefd[2];
+    *pid = -1;
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
+    {
+        fprintf(stderr, "pipestat: %s\n", strerror(errno));
+        return input;
+    }
+
+    fflush(NULL);
+    *pid = fork();
+    if (*pid == 0)
+    {
+        close(pipefd[0]);
+        runMeter(input, pipefd[1], meter);
+        _exit(0);
+    }
+    if (*pid < 0)
+    {
+        fprintf(stderr, "pipestat: %s\n", strerror(errno));
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return input;
+    }
+    STAT_ADD(forks, 1);
+    close(input);
+    close(pipefd[1]);
+    return pipefd[0];
+}
+
+/*
+ * Body of a meter process: moves in to out with non-blocking splice()
+ * so no byte is copied through user space. When a splice cannot move
+ * anything, poll() on in tells whether the producer is late; if it is
+ * not, the consumer is, and the time until out has room is charged to
+ * it. Either way the meter stops once the consumer has exited, even if
+ * the producer still holds its end. After each splice FIONREAD samples how much the consumer has left
+ * unread.
+ */
+void runMeter(int in, int out, struct pipeMeter *meter)
+{
+    signal(SIGPIPE, SIG_IGN); // A consumer that is gone ends the meter through EPIPE
+    meter->start = nowMicros();
+    for (;;)
+    {
+        ssize_t n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            int queued = 0;
+            meter->bytes += n;
+            if (ioctl(out, FIONREAD, &queued) == 0)
+            {
+                meter->queuedSum += queued;
+                meter->queuedMax = (uint64_t)queued > meter->queuedMax ? (uint64_t)queued : meter->queuedMax;
+                meter->samples++;
+            }
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        {
+            break; // End of input, or EPIPE
+        }
+
+        /* out is always watched, POLLERR there means the consumer is gone */
+        struct pollfd pfds[2] = {{out, 0, 0}, {in, POLLIN, 0}};
+        int waitingForProducer = poll(&pfds[1], 1, 0) == 0;
+        pfds[0].events = waitingForProducer ? 0 : POLLOUT;
+        double start = nowMicros();
+        while (poll(pfds, 1 + waitingForProducer, -1) < 0 && errno == EINTR)
+            ;
+        *(waitingForProducer ? &meter->producerWait : &meter->consumerWait) += nowMicros() - start;
+        if (pfds[0].revents & POLLERR)
+        {
+            break;
+        }
+    }
+    meter->end = nowMicros();
+}
+
+/*
+ * Prints a line per metered pipe: throughput, time spent waiting on each side
+ * and how full the consumer's pipe was. The stage that kept its
+ * neighbours waiting longest is named as the bottleneck.
+ */
+void pipestatReport(struct pipeMeter meters[], int count, char **stages[])
+{
+    double waitedFor[MAX_STAGES] = {0};
+    fprintf(stderr, "\n Pipe stats:\n %-24s %14s %10s %13s %13s %10s %10s\n",
+            "pipe", "bytes", "MB/s", "producer ms", "consumer ms", "queued avg", "queued max");
+    for (int i = 0; i < count; i++)
+    {
+        struct pipeMeter *m = &meters[i];
+        char name[64];
+        if (m->start == 0)
+        {
+            continue; // Its meter could not be started
+        }
+        double seconds = (m->end - m->start) / 1e6;
+        snprintf(name, sizeof(name), "%s | %s", stages[i][0], stages[i + 1][0]);
+        fprintf(stderr, " %-24.24s %14llu %10.2f %13.2f %13.2f %10llu %10llu\n", name, (unsigned long long)m->bytes,
+                seconds > 0 ? m->bytes / seconds / 1e6 : 0.0, m->producerWait / 1e3, m->consumerWait / 1e3,
+                (unsigned long long)(m->samples > 0 ? m->queuedSum / m->samples : 0), (unsigned long long)m->queuedMax);
+        waitedFor[i] += m->producerWait;
+        waitedFor[i + 1] += m->consumerWait;
+    }
+
+    int slowest = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        slowest = waitedFor[i] > waitedFor[slowest] ? i : slowest;
+    }
+    if (waitedFor[slowest] > 0)
+    {
+        fprintf(stderr, " bottleneck: %s, waited for %.2f ms\n", stages[slowest][0], waitedFor[slowest] / 1e3);
+    }
+}
+
+/* Forks a child for a command, hooking up perfstat and tracing */
+pid_t forkCommand(const char *name)
+{
+    findCommandPath(name, resolvedPath); // Resolved in the parent so the cache outlives the child
+    buildEnvironment();                  // Likewise the envp, children only patch it
+    perfBeforeFork();
+    double start = nowMicros();
+    spawnStart = start;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        perfChildWait();
+    }
+    else if (pid > 0)
+    {
+        STAT_ADD(forks, 1);
+        traceEvent("fork", 'X', start, nowMicros(), name);
+        perfAttach(pid, name);
+    }
+    return pid;
+}
+
+/* Like forkCommand(), but returns 0 without forking when the shell has nothing left to do after this command */
+pid_t forkUnlessLast(const char *name, int background)
+{
+    if (!execInPlace || background || perfstatMode)
+    {
+        return forkCommand(name);
+    }
+
+    /* The caller takes the child branch in this process, so the command keeps the shell's PID */
+    findCommandPath(name, resolvedPath);
+    buildEnvironment();
+    fflush(NULL); // Output of earlier builtins must not be lost by the exec
+    spawnStart = nowMicros();
+    statsExport(1);
+    traceEvent("exec in place", 'i', spawnStart, 0, name);
+    traceStop(); // The exec would leave the trace without its closing ]
+    return 0;
+}
+
+/* Finds and execs the command, only returns to exit the child on failure */
+void execCommand(char *args[])
+{
+    /*
+     * Leading NAME=value words go straight into this process's copy of the
+     * cached envp: replaced in place or appended into the spare slots.
+     */
+    while (args[0] != NULL && assignmentLength(args[0]) > 0)
+    {
+        size_t length = assignmentLength(args[0]) + 1; // Including the '='
+        int i;
+        for (i = 0; i < environmentCount; i++)
+        {
+            if (strncmp(environment[i], args[0], length) == 0)
+            {
+                break;
+            }
+        }
+        environment[i] = args[0];
+        if (i == environmentCount)
+        {
+            environment[++environmentCount] = NULL;
+        }
+        args++;
+    }
+
+    if (resolvedPath[0] == '\0')
+    {
+        STAT_ADD(execFailures, 1);
+        fprintf(stderr, "Command not found: %s\n", args[0]);
+        exit(127);
+    }
+
+    /* Spawn latency is fork() to execv() */
+    double now = nowMicros();
+    uint64_t latency = now > spawnStart ? (uint64_t)(now - spawnStart) : 0;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (latency >> (bucket + 1)) != 0)
+    {
+        bucket++;
+    }
+    STAT_ADD(spawnLatency[bucket], 1);
+    STAT_ADD(spawnLatencySum, latency);
+
+    traceEvent("exec", 'i', now, 0, resolvedPath);
+    if (execve(resolvedPath, args, environment) == -1)
+    {
+        STAT_ADD(execFailures, 1);
+        fprintf(stderr, "Command execution failed");
+        exit(126);
+    }
+}
+
+/* Called once for every reaped child, also from the SIGCHLD handler */
+void childReaped(pid_t pid)
+{
+    if (traceFd != -1)
+    {
+        char detail[16];
+        snprintf(detail, sizeof(detail), "%d", pid);
+        traceEvent("reap", 'i', nowMicros(), 0, detail);
+    }
+    perfReport(pid);
+}
+
+/* Opens a Chrome trace-event file, replacing any trace already running */
+void traceStart(const char *path)
+{
+    traceStop();
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (traceFd < 0)
+    {
+        fprintf(stderr, "trace: cannot open %s\n", path);
+        return;
+    }
+
+    /* Every event after this one starts with a comma, so children can append without coordination */
+    char header[128];
+    int len = snprintf(header, sizeof(header),
+                       "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"myshell\"}}",
+                       getpid(), getpid());
+    write(traceFd, header, len);
+}
+
+/* Closes the JSON array and the trace file */
+void traceStop(void)
+{
+    if (traceFd == -1)
+    {
+        return;
+    }
+    write(traceFd, "\n]\n", 3);
+    close(traceFd);
+    traceFd = -1;
+}
+
+/* Monotonic clock in microseconds, the unit of the trace-event format */
+double nowMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Appends one event; phase 'X' is a complete event from start to end, 'i' is an instant */
+void traceEvent(const char *name, char phase, double start, double end, const char *detail)
+{
+    if (traceFd == -1)
+    {
+        return;
+    }
+
+    /* Keep the detail valid inside a JSON string */
+    char safe[MAX_LINE];
+    int n = 0;
+    for (int i = 0; detail != NULL && detail[i] != '\0' && n < MAX_LINE - 1; i++)
+    {
+        if (detail[i] != '"' && detail[i] != '\\' && (unsigned char)detail[i] >= 32)
+            safe[n++] = detail[i];
+    }
+    safe[n] = '\0';
+
+    char event[MAX_LINE + 192];
+    int len;
+    if (phase == 'X')
+    {
+        len = snprintf(event, sizeof(event),
+                       ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"detail\":\"%s\"}}",
+                       name, start, end - start, getpid(), getpid(), safe);
+    }
+    else
+    {
+        len = snprintf(event, sizeof(event),
+                       ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"detail\":\"%s\"}}",
+                       name, start, getpid(), getpid(), safe);
+    }
+    write(traceFd, event, len); // One O_APPEND write per event keeps the parent and children from interleaving
+}
+
+/* Moves the counters to memory shared with the children */
+void statsInit(void)
+{
+    void *shared = mmap(NULL, sizeof(struct statsBlock), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared != MAP_FAILED)
+    {
+        shellStats = shared; // Zero filled by the kernel
+    }
+}
+
+/* Upper bound in microseconds of the bucket holding the given quantile */
+uint64_t latencyQuantile(double quantile)
+{
+    uint64_t total = 0, seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += shellStats->spawnLatency[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += shellStats->spawnLatency[i];
+        if (seen >= quantile * total)
+        {
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return (uint64_t)1 << LATENCY_BUCKETS;
+}
+
+/* Prints the counters, as a table or in Prometheus exposition format */
+void statsPrint(FILE *out, int prometheus)
+{
+    struct
+    {
+        const char *name;
+        const char *help;
+        uint64_t value;
+    } counters[] = {
+        {"commands", "Command lines executed", shellStats->commands},
+        {"forks", "Child processes forked", shellStats->forks},
+        {"exec_failures", "Children that could not exec their command", shellStats->execFailures},
+        {"path_cache_hits", "Command path cache hits", shellStats->pathHits},
+        {"path_cache_misses", "Command path cache misses", shellStats->pathMisses},
+        {"glob_cache_hits", "Directory listing cache hits", shellStats->globHits},
+        {"glob_cache_misses", "Directory listings read for globbing", shellStats->globMisses},
+        {"append_cache_hits", ">> targets served from open descriptors", shellStats->appendHits},
+        {"append_cache_misses", ">> targets opened", shellStats->appendMisses},
+        {"pipe_stages_signalled", "Pipe stages sent SIGPIPE when a later stage exited", shellStats->pipeSignals},
+        {"background_started", "Background jobs started", shellStats->bgStarted},
+        {"background_reaped", "Background jobs reaped", shellStats->bgReaped},
+    };
+    int count = sizeof(counters) / sizeof(counters[0]);
+
+    if (!prometheus)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, "%-20s %llu\n", counters[i].name, (unsigned long long)counters[i].value);
+        }
+        fprintf(out, "%-20s %llu us\n", "spawn_latency_p50", (unsigned long long)latencyQuantile(0.50));
+        fprintf(out, "%-20s %llu us\n", "spawn_latency_p99", (unsigned long long)latencyQuantile(0.99));
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, "# HELP myshell_%s_total %s.\n# TYPE myshell_%s_total counter\nmyshell_%s_total %llu\n",
+                counters[i].name, counters[i].help, counters[i].name, counters[i].name,
+                (unsigned long long)counters[i].value);
+    }
+
+    uint64_t cumulative = 0;
+    fprintf(out, "# HELP myshell_spawn_latency_microseconds Time from fork to exec.\n");
+    fprintf(out, "# TYPE myshell_spawn_latency_microseconds histogram\n");
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        cumulative += shellStats->spawnLatency[i];
+        fprintf(out, "myshell_spawn_latency_microseconds_bucket{le=\"%llu\"} %llu\n",
+                (unsigned long long)1 << (i + 1), (unsigned long long)cumulative);
+    }
+    fprintf(out, "myshell_spawn_latency_microseconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+    fprintf(out, "myshell_spawn_latency_microseconds_sum %llu\n", (unsigned long long)shellStats->spawnLatencySum);
+    fprintf(out, "myshell_spawn_latency_microseconds_count %llu\n", (unsigned long long)cumulative);
+}
+
+/* Rewrites the metrics file when the interval has passed, renaming so scrapers never see half a file */
+void statsExport(int force)
+{
+    if (statsFile == NULL)
+    {
+        return;
+    }
+    double now = nowMicros();
+    if (!force && now - statsWritten < statsInterval * 1e6)
+    {
+        return;
+    }
+    statsWritten = now;
+
+    /* A name of its own, so shells exporting to the same file never write into each other's copy */
+    char tmpPath[4096];
+    int fd = openTemporary(statsFile, tmpPath, sizeof(tmpPath));
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (out == NULL)
+    {
+        fprintf(stderr, "stats: cannot write %s\n", tmpPath);
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmpPath);
+        }
+        return;
+    }
+    fchmod(fd, 0644); // Readable by the scraper, mkostemp() makes it 0600
+    statsPrint(out, 1);
+    if (fclose(out) != 0 || rename(tmpPath, statsFile) < 0)
+    {
+        fprintf(stderr, "stats: cannot write %s\n", tmpPath);
+        unlink(tmpPath);
+    }
+}
+
+/* Opens the session file and writes its header and the terminal size */
+void recordStart(const char *path)
+{
+    recordFile = fopen(path, "w");
+    if (recordFile == NULL)
+    {
+        fprintf(stderr, "record: cannot open %s\n", path);
+        return;
+    }
+    fcntl(fileno(recordFile), F_SETFD, FD_CLOEXEC); // Commands must not inherit it
+
+    memset(&recordSize, 0, sizeof(recordSize));
+    ioctl(STDIN_FILENO, TIOCGWINSZ, &recordSize);
+    fprintf(recordFile, "# myshell session 1\nwinsize %d %d\n", recordSize.ws_row, recordSize.ws_col);
+    recordLast = nowMicros();
+}
+
+/* Appends "line <microseconds since previous line> <text>", escaping tabs, newlines and backslashes */
+void recordLine(const char *line, int length)
+{
+    if (recordFile == NULL || length <= 0)
+    {
+        return;
+    }
+
+    struct winsize size;
+    memset(&size, 0, sizeof(size));
+    ioctl(STDIN_FILENO, TIOCGWINSZ, &size);
+    if (size.ws_row != recordSize.ws_row || size.ws_col != recordSize.ws_col)
+    {
+        recordSize = size;
+        fprintf(recordFile, "winsize %d %d\n", size.ws_row, size.ws_col);
+    }
+
+    double now = nowMicros();
+    fprintf(recordFile, "line %.0f ", now - recordLast);
+    recordLast = now;
+
+    if (line[length - 1] == '\n')
+    {
+        length--; // Every record is one line, the newline is implied
+    }
+    for (int i = 0; i < length; i++)
+    {
+        switch (line[i])
+        {
+        case '\\':
+            fputs("\\\\", recordFile);
+            break;
+        case '\n':
+            fputs("\\n", recordFile);
+            break;
+        case '\t':
+            fputs("\\t", recordFile);
+            break;
+        default:
+            fputc(line[i], recordFile);
+        }
+    }
+    fputc('\n', recordFile);
+    fflush(recordFile); // The session survives a crash of the shell
+}
+
+/* Returns the alias with the given name or NULL */
+struct alias *findAlias(const char *name)
+{
+    if (aliasCount == 0)
+    {
+        return NULL; // Lines without any alias defined skip hashing
+    }
+
+    for (struct alias *entry = aliasTable[stringHash(name) & (aliasBuckets - 1)]; entry != NULL; entry = entry->next)
+    {
+        if (strcmp(entry->name, name) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Adds an alias or replaces its value, growing the table past a load factor of one */
+void setAlias(const char *name, const char *value)
+{
+    struct alias *entry = findAlias(name);
+    if (entry != NULL)
+    {
+        if (!fromSnapshot(entry->value))
+            free(entry->value);
+        entry->value = strdup(value);
+        return;
+    }
+
+    if (aliasCount >= aliasBuckets)
+    {
+        unsigned buckets = aliasBuckets ? aliasBuckets * 2 : 16;
+        struct alias **table = calloc(buckets, sizeof(struct alias *));
+        if (table == NULL)
+        {
+            fprintf(stderr, "alias: out of memory\n");
+            return;
+        }
+
+        /* Move every alias to its bucket in the bigger table */
+        for (unsigned i = 0; i < aliasBuckets; i++)
+        {
+            while (aliasTable[i] != NULL)
+            {
+                struct alias *moved = aliasTable[i];
+                aliasTable[i] = moved->next;
+                unsigned slot = stringHash(moved->name) & (buckets - 1);
+                moved->next = table[slot];
+                table[slot] = moved;
+            }
+        }
+        free(aliasTable);
+        aliasTable = table;
+        aliasBuckets = buckets;
+    }
+
+    entry = malloc(sizeof(struct alias));
+    entry->name = strdup(name);
+    entry->value = strdup(value);
+    unsigned slot = stringHash(name) & (aliasBuckets - 1);
+    entry->next = aliasTable[slot];
+    aliasTable[slot] = entry;
+    aliasCount++;
+}
+
+/* Deletes an alias, returns 0 if it did not exist */
+int removeAlias(const char *name)
+{
+    if (aliasCount == 0)
+    {
+        return 0;
+    }
+
+    struct alias **link = &aliasTable[stringHash(name) & (aliasBuckets - 1)];
+    for (; *link != NULL; link = &(*link)->next)
+    {
+        if (strcmp((*link)->name, name) == 0)
+        {
+            struct alias *entry = *link;
+            *link = entry->next;
+            if (!fromSnapshot(entry->name))
+                free(entry->name);
+            if (!fromSnapshot(entry->value))
+                free(entry->value);
+            if (!fromSnapshot(entry))
+                free(entry);
+            aliasCount--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Prints every alias as "name -> command" */
+void listAliases(void)
+{
+    for (unsigned i = 0; i < aliasBuckets; i++)
+    {
+        for (struct alias *entry = aliasTable[i]; entry != NULL; entry = entry->next)
+        {
+            printf("%s -> %s\n", entry->name, entry->value);
+        }
+    }
+}
+
+/* alias "command words" name, or alias -l to list */
+int aliasCommand(char *args[])
+{
+    if (args[1] != NULL && strcmp(args[1], "-l") == 0)
+    {
+        listAliases();
+        return 0;
+    }
+
+    int last = 0;
+    while (args[last + 1] != NULL)
+    {
+        last++;
+    }
+    if (last < 2)
+    {
+        fprintf(stderr, "Usage: alias \"command\" name | alias -l\n");
+        return 2;
+    }
+
+    /* setup() split the quoted command at blanks, join the words back together */
+    char value[MAX_LINE] = {0};
+    for (int i = 1; i < last; i++)
+    {
+        strncat(value, args[i], MAX_LINE - strlen(value) - 2);
+        if (i + 1 < last)
+        {
+            strcat(value, " ");
+        }
+    }
+    char *start = value;
+    size_t length = strlen(value);
+    if (*start == '"')
+    {
+        start++;
+        length--;
+    }
+    if (length > 0 && start[length - 1] == '"')
+    {
+        start[--length] = '\0';
+    }
+    if (length == 0)
+    {
+        fprintf(stderr, "alias: empty command\n");
+        return 1;
+    }
+
+    setAlias(args[last], start);
+    return 0;
+}
+
+/*
+ * Splices the words of an alias in place of each command word: args[0]
+ * and every word after a |. The words of each expansion are copied into
+ * the arena, so they stay valid for the whole line and never overwrite
+ * one another. Returns -1 if the line gets too long.
+ */
+int expandAlias(char *args[])
+{
+    int argCount = 0;
+    while (args[argCount] != NULL)
+    {
+        argCount++;
+    }
+
+    for (int i = 0, depth = 0; i < argCount; i++)
+    {
+        depth = groupDepth(args, i, depth); // Commands inside groups expand when they run
+        struct alias *entry = depth == 0 && (i == 0 || strcmp(args[i - 1], "|") == 0) ? findAlias(args[i]) : NULL;
+        if (entry == NULL)
+        {
+            continue;
+        }
+
+        /* Split the alias value into words inside its own copy */
+        char *words[MAX_LINE / 2 + 1];
+        int wordCount = 0;
+        char *value = arenaString(entry->value, strlen(entry->value));
+        char *saveptr;
+        for (char *word = strtok_r(value, " \t", &saveptr); word != NULL && wordCount <= MAX_LINE / 2; word = strtok_r(NULL, " \t", &saveptr))
+        {
+            words[wordCount++] = word;
+        }
+        if (wordCount == 0)
+        {
+            continue; // Blank alias, run the command as typed
+        }
+        if (wordCount + argCount - 1 > MAX_LINE / 2)
+        {
+            fprintf(stderr, "alias: expanded command is too long\n");
+            return -1;
+        }
+
+        /* Make room for the alias words, then copy them over args[i] */
+        memmove(&args[i + wordCount], &args[i + 1], (argCount - i) * sizeof(char *)); // Includes the NULL terminator
+        memcpy(&args[i], words, wordCount * sizeof(char *));
+        argCount += wordCount - 1;
+        i += wordCount - 1; // Alias words are not expanded again
+    }
+    return 0;
+}
+
+/* Takes over the inherited environment without copying its strings */
+void variablesInit(void)
+{
+    extern char **environ;
+    for (char **entry = environ; *entry != NULL; entry++)
+    {
+        char *equals = strchr(*entry, '=');
+        if (equals == NULL || findVariable(*entry, equals - *entry) != NULL)
+        {
+            continue;
+        }
+        if (variableCount == variableCapacity)
+        {
+            variableCapacity = variableCapacity ? variableCapacity * 2 : 64;
+            variables = realloc(variables, variableCapacity * sizeof(struct variable));
+        }
+        struct variable *variable = &variables[variableCount++];
+        variable->text = *entry;
+        variable->nameLength = equals - *entry;
+        variable->exported = 1;
+        variable->owned = 0;
+    }
+    environmentDirty = 1;
+}
+
+/* Looks up a variable by the first length characters of name */
+struct variable *findVariable(const char *name, size_t length)
+{
+    for (int i = 0; i < variableCount; i++)
+    {
+        if (variables[i].nameLength == length && memcmp(variables[i].text, name, length) == 0)
+        {
+            return &variables[i];
+        }
+    }
+    return NULL;
+}
+
+/* Value of a variable, NULL if it is not set */
+char *getVariable(const char *name)
+{
+    struct variable *variable = findVariable(name, strlen(name));
+    return variable != NULL ? variable->text + variable->nameLength + 1 : NULL;
+}
+
+/* Sets NAME=value; a variable keeps being exported once it was */
+void setVariable(const char *assignment, int exported)
+{
+    size_t length = strchr(assignment, '=') - assignment;
+    struct variable *variable = findVariable(assignment, length);
+    if (variable == NULL)
+    {
+        if (variableCount == variableCapacity)
+        {
+            variableCapacity = variableCapacity ? variableCapacity * 2 : 64;
+            variables = realloc(variables, variableCapacity * sizeof(struct variable));
+        }
+        variable = &variables[variableCount++];
+        variable->nameLength = length;
+        variable->exported = 0;
+        variable->owned = 0;
+        variable->text = NULL;
+    }
+    else if (variable->owned)
+    {
+        free(variable->text);
+    }
+    variable->text = strdup(assignment);
+    variable->owned = 1;
+    if (exported || variable->exported)
+    {
+        variable->exported = 1;
+        environmentDirty = 1;
+    }
+}
+
+/* Removes a variable */
+void unsetVariable(const char *name)
+{
+    struct variable *variable = findVariable(name, strlen(name));
+    if (variable == NULL)
+    {
+        return;
+    }
+    if (variable->exported)
+    {
+        environmentDirty = 1;
+    }
+    if (variable->owned)
+    {
+        free(variable->text);
+    }
+    *variable = variables[--variableCount]; // Order does not matter
+}
+
+/*
+ * Rebuilds the envp of exported variables, only when one changed since the
+ * last command. The array has spare slots so a child can append its
+ * per-command assignments without copying anything.
+ */
+void buildEnvironment(void)
+{
+    if (!environmentDirty)
+    {
+        return;
+    }
+    free(environment);
+    environment = malloc((variableCount + MAX_LINE / 2 + 1) * sizeof(char *));
+    environmentCount = 0;
+    for (int i = 0; i < variableCount; i++)
+    {
+        if (variables[i].exported)
+        {
+            environment[environmentCount++] = variables[i].text;
+        }
+    }
+    environment[environmentCount] = NULL;
+    environmentDirty = 0;
+}
+
+/* Length of NAME if word is a NAME=value assignment, 0 otherwise */
+int assignmentLength(const char *word)
+{
+    int i = 0;
+    if (!(word[0] == '_' || (word[0] >= 'A' && word[0] <= 'Z') || (word[0] >= 'a' && word[0] <= 'z')))
+    {
+        return 0;
+    }
+    while (word[i] == '_' || (word[i] >= 'A' && word[i] <= 'Z') || (word[i] >= 'a' && word[i] <= 'z') ||
+           (word[i] >= '0' && word[i] <= '9'))
+    {
+        i++;
+    }
+    return word[i] == '=' ? i : 0;
+}
+
+/* The command of args[], past any NAME=value words */
+char *commandName(char *args[])
+{
+    while (args[0] != NULL && assignmentLength(args[0]) > 0)
+    {
+        args++;
+    }
+    return args[0] != NULL ? args[0] : "";
+}
+
+/* export NAME[=value]..., or export alone to list */
+int exportCommand(char *args[])
+{
+    if (args[1] == NULL)
+    {
+        for (int i = 0; i < variableCount; i++)
+        {
+            if (variables[i].exported)
+            {
+                printf("export %s\n", variables[i].text);
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        if (assignmentLength(args[i]) > 0)
+        {
+            setVariable(args[i], 1);
+            continue;
+        }
+        char assignment[MAX_LINE];
+        snprintf(assignment, sizeof(assignment), "%s=", args[i]);
+        if (assignmentLength(assignment) == 0)
+        {
+            fprintf(stderr, "export: %s: not a valid name\n", args[i]);
+            status = 1;
+            continue;
+        }
+        struct variable *variable = findVariable(args[i], strlen(args[i]));
+        if (variable == NULL)
+        {
+            setVariable(assignment, 1); // Exported with an empty value
+        }
+        else if (!variable->exported)
+        {
+            variable->exported = 1;
+            environmentDirty = 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * copy [source [destination]] copies standard input or source to standard
+ * output or destination without a process and without the data passing
+ * through the shell. cat file... > out comes here too, one source at a time.
+ */
+int copyCommand(char *args[])
+{
+    int cat = strcmp(args[0], "cat") == 0;
+    if (!cat && args[1] != NULL && args[2] != NULL && args[3] != NULL)
+    {
+        printf("Usage: copy [source [destination]]\n");
+        return 2;
+    }
+
+    int out = STDOUT_FILENO;
+    if (!cat && args[1] != NULL && args[2] != NULL)
+    {
+        out = open(args[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0)
+        {
+            fprintf(stderr, "copy: %s: %s\n", args[2], strerror(errno));
+            return 1;
+        }
+    }
+
+    /* A regular file output keeps copy_file_range() and reflinks, io_uring suits pipes and devices */
+    struct stat st;
+    int status = 0;
+    if (cat && args[2] != NULL && (fstat(out, &st) < 0 || !S_ISREG(st.st_mode)) && uringReady())
+    {
+        int files = 1;
+        while (args[files + 1] != NULL)
+        {
+            files++;
+        }
+        return uringCat(args + 1, files, out); // Opens, reads and writes a batch of files per system call
+    }
+    for (int i = 1; i == 1 || (cat && args[i] != NULL); i++)
+    {
+        int in = STDIN_FILENO;
+        if (args[i] != NULL)
+        {
+            in = open(args[i], O_RDONLY | O_CLOEXEC);
+            if (in < 0)
+            {
+                fprintf(stderr, "%s: %s: %s\n", args[0], args[i], strerror(errno));
+                status = 1;
+                continue; // cat goes on with the next file
+            }
+        }
+        if (copyFd(in, out) < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", args[0], args[i] != NULL ? args[i] : "standard input", strerror(errno));
+            status = 1;
+        }
+        if (in != STDIN_FILENO)
+        {
+            close(in);
+        }
+    }
+    if (out != STDOUT_FILENO)
+    {
+        close(out);
+    }
+    return status;
+}
+
+/* cat with only file operands and its output redirected to a file runs as copy */
+int catToFile(char *args[], struct redirection list[], int count)
+{
+    if (args[0] == NULL || strcmp(args[0], "cat") != 0 || args[1] == NULL)
+    {
+        return 0;
+    }
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        if (args[i][0] == '-')
+        {
+            return 0; // Options and - for standard input are left to cat(1)
+        }
+    }
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (list[i].fd == STDOUT_FILENO)
+        {
+            return list[i].kind != REDIRECT_HEREDOC && list[i].target != NULL; // The last one wins
+        }
+    }
+    return 0;
+}
+
+/*
+ * Copies in from its offset to its end into out at its offset, with the
+ * cheapest method the two descriptors allow: a FICLONE reflink for a
+ * whole file into an empty one, copy_file_range() between files,
+ * sendfile() into anything else and splice() out of a pipe. Holes of a
+ * sparse source are found with SEEK_DATA and SEEK_HOLE and left as holes
+ * when out is a file being extended. Returns -1 with errno set on error.
+ */
+int copyFd(int in, int out)
+{
+    struct stat inStat, outStat;
+    if (fstat(in, &inStat) < 0 || fstat(out, &outStat) < 0)
+    {
+        return -1;
+    }
+    int appending = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+    int method = appending ? 2 : 0; // copy_file_range(), sendfile() and splice() all refuse O_APPEND
+
+    if (S_ISFIFO(inStat.st_mode))
+    {
+        while (!appending)
+        {
+            ssize_t n = splice(in, NULL, out, NULL, 1 << 16, SPLICE_F_MOVE);
+            if (n == 0)
+            {
+                return 0;
+            }
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EINVAL)
+                    return -1;
+                break; // Not spliceable, copy it below
+            }
+        }
+    }
+    if (!S_ISREG(inStat.st_mode))
+    {
+        method = 2; // Terminals and the like
+        return copyRange(in, out, -1, &method);
+    }
+
+    off_t position = lseek(in, 0, SEEK_CUR);
+    off_t end = inStat.st_size;
+    int outRegular = S_ISREG(outStat.st_mode) && !appending;
+    off_t outPosition = outRegular ? lseek(out, 0, SEEK_CUR) : -1;
+
+    /* A whole file into an empty one shares the extents on btrfs, xfs and the like */
+    if (outRegular && position == 0 && outPosition == 0 && outStat.st_size == 0 && end > 0 &&
+        ioctl(out, FICLONE, in) == 0)
+    {
+        lseek(in, end, SEEK_SET);
+        lseek(out, end, SEEK_SET);
+        return 0;
+    }
+
+    /* Holes are skipped only when nothing is behind them in out */
+    int sparse = outRegular && outPosition >= outStat.st_size;
+    off_t skipped = 0;
+    while (position < end)
+    {
+        off_t data = position, hole = end;
+        if (sparse)
+        {
+            data = lseek(in, position, SEEK_DATA);
+            if (data < 0 && errno == ENXIO)
+            {
+                data = end; // Only a hole is left
+            }
+            else if (data < 0)
+            {
+                sparse = 0; // No SEEK_DATA here, copy everything
+                data = position;
+            }
+            hole = data < end ? lseek(in, data, SEEK_HOLE) : end;
+            if (hole < 0 || hole > end)
+            {
+                hole = end;
+            }
+        }
+        if (data > position)
+        {
+            lseek(out, data - position, SEEK_CUR);
+            skipped = data == end;
+        }
+        if (data < end)
+        {
+            lseek(in, data, SEEK_SET);
+            if (copyRange(in, out, hole - data, &method) < 0)
+            {
+                return -1;
+            }
+        }
+        position = hole;
+    }
+    if (skipped)
+    {
+        ftruncate(out, lseek(out, 0, SEEK_CUR)); // A trailing hole still counts in the size
+    }
+    return 0;
+}
+
+/*
+ * Copies length bytes, or up to end of file for -1, from the offset of in
+ * to the offset of out. *method is 0 for copy_file_range(), 1 for sendfile()
+ * and 2 for read() and write(); it drops to the next one when the kernel
+ * refuses a pair of descriptors and stays there for the rest of the copy.
+ */
+int copyRange(int in, int out, off_t length, int *method)
+{
+    char buffer[1 << 16];
+    while (length != 0)
+    {
+        size_t chunk = length < 0 || length > (1 << 30) ? (1 << 30) : (size_t)length;
+        ssize_t n;
+        if (*method == 0)
+        {
+            n = copy_file_range(in, NULL, out, NULL, chunk, 0);
+        }
+        else if (*method == 1)
+        {
+            n = sendfile(out, in, NULL, chunk);
+        }
+        else if (uringReady())
+        {
+            return uringStream(in, &out, 1, length);
+        }
+        else
+        {
+            n = read(in, buffer, chunk < sizeof(buffer) ? chunk : sizeof(buffer));
+            for (ssize_t done = 0; n > 0 && done < n;)
+            {
+                ssize_t written = write(out, buffer + done, n - done);
+                if (written < 0 && errno != EINTR)
+                {
+                    return -1;
+                }
+                done += written > 0 ? written : 0;
+            }
+        }
+
+        if (n == 0)
+        {
+            return 0; // End of file, or the source shrank
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (*method < 2 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+            {
+                (*method)++;
+                continue;
+            }
+            return -1;
+        }
+        if (length > 0)
+        {
+            length -= n;
+        }
+    }
+    return 0;
+}
+
+/* Tells if the tee builtin handles args: an optional -a, then files */
+int teeSupported(char *args[])
+{
+    int i = args[1] != NULL && strcmp(args[1], "-a") == 0 ? 2 : 1;
+    for (; args[i] != NULL; i++)
+    {
+        if (args[i][0] == '-')
+        {
+            return 0; // Other options, and - itself, are left to tee(1)
+        }
+    }
+    return 1;
+}
+
+/* tee [-a] [file...] copies standard input to standard output and each file */
+int teeCommand(char *args[])
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int first = 1;
+    if (args[1] != NULL && strcmp(args[1], "-a") == 0)
+    {
+        flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        first = 2;
+    }
+
+    int outs[MAX_ARGS + 1] = {STDOUT_FILENO};
+    int outCount = 1, status = 0;
+    for (int i = first; args[i] != NULL && outCount <= MAX_ARGS; i++)
+    {
+        int fd = open(args[i], flags, 0644);
+        if (fd < 0)
+        {
+            fprintf(stderr, "tee: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        outs[outCount++] = fd;
+    }
+
+    int failed = 0;
+    if (uringReady())
+    {
+        failed = uringStream(STDIN_FILENO, outs, outCount, -1) < 0;
+    }
+    else
+    {
+        char buffer[1 << 16];
+        ssize_t n;
+        while ((n = read(STDIN_FILENO, buffer, sizeof(buffer))) != 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                failed = 1;
+                break;
+            }
+            for (int i = 0; i < outCount; i++)
+            {
+                failed |= writeAll(outs[i], buffer, n, -1) < 0;
+            }
+        }
+    }
+    if (failed)
+    {
+        fprintf(stderr, "tee: %s\n", strerror(errno));
+        status = 1;
+    }
+
+    for (int i = 1; i < outCount; i++)
+    {
+        close(outs[i]);
+    }
+    return status;
+}
+
+/* Tells if the wc builtin handles args: -l, -w and -c, then files */
+int wcSupported(char *args[])
+{
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strspn(args[i] + 1, "lwc") != strlen(args[i] + 1))
+        {
+            return 0;
+        }
+    }
+    for (; args[i] != NULL; i++)
+    {
+        if (args[i][0] == '-' && args[i][1] != '\0')
+        {
+            return 0; // wc(1) also takes options after the files
+        }
+    }
+    return 1;
+}
+
+/* wc [-l] [-w] [-c] [file...] prints line, word and byte counts like wc(1) */
+int wcCommand(char *args[])
+{
+    int lines = 0, words = 0, bytes = 0, first = 1;
+    for (; args[first] != NULL && args[first][0] == '-' && args[first][1] != '\0'; first++)
+    {
+        for (const char *option = args[first] + 1; *option != '\0'; option++)
+        {
+            if (*option == 'l')
+                lines = 1;
+            else if (*option == 'w')
+                words = 1;
+            else if (*option == 'c')
+                bytes = 1;
+            else
+            {
+                fprintf(stderr, "wc: invalid option -- '%c'\n", *option);
+                return 2;
+            }
+        }
+    }
+    if (!lines && !words && !bytes)
+    {
+        lines = words = bytes = 1;
+    }
+
+    int files = 0;
+    while (args[first + files] != NULL)
+    {
+        files++;
+    }
+    int inputs = files > 0 ? files : 1;
+    uint64_t (*counts)[3] = arenaAlloc((inputs + 1) * sizeof(*counts));
+    int *failed = arenaAlloc(inputs * sizeof(int));
+    memset(counts, 0, (inputs + 1) * sizeof(*counts));
+
+    /* Like wc(1), a single count of a single input is not padded */
+    int width = 1, minimum = 1, status = 0;
+    uint64_t regularTotal = 0;
+    for (int i = 0; i < inputs; i++)
+    {
+        const char *name = files > 0 ? args[first + i] : NULL;
+        int fd = name != NULL && strcmp(name, "-") != 0 ? open(name, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        struct stat st;
+        failed[i] = fd < 0 || fstat(fd, &st) < 0;
+        if (failed[i])
+        {
+            fprintf(stderr, "wc: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (S_ISREG(st.st_mode))
+            regularTotal += st.st_size;
+        else
+            minimum = 7;
+
+        /* A regular file, redirected with < too, is mapped a window at a time and never copied */
+        off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+        int inWord = 0;
+        if (offset >= 0 && !lines && !words)
+        {
+            counts[i][2] = st.st_size > offset ? st.st_size - offset : 0; // Nothing to read for -c
+        }
+        for (off_t base = offset - offset % WC_WINDOW; offset >= 0 && (lines || words) && base < st.st_size; base += WC_WINDOW)
+        {
+            size_t size = st.st_size - base < WC_WINDOW ? st.st_size - base : WC_WINDOW;
+            void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, base);
+            if (data == MAP_FAILED)
+            {
+                lseek(fd, base > offset ? base : offset, SEEK_SET); // Read the rest
+                offset = -1;
+                break;
+            }
+            madvise(data, size, MADV_SEQUENTIAL);
+            size_t skip = base < offset ? offset - base : 0;
+            wcCount((unsigned char *)data + skip, size - skip, counts[i], &inWord, words);
+            munmap(data, size);
+        }
+        if (offset >= 0 && fd == STDIN_FILENO)
+        {
+            lseek(fd, st.st_size, SEEK_SET); // Consumed, as if it had been read
+        }
+
+        /* Otherwise, with io_uring the next buffer is read while this one is counted */
+        int uring = offset < 0 && uringReady(), slot = 0;
+        char buffer[1 << 16];
+        ssize_t n = 0;
+        if (uring)
+        {
+            uringQueueFixed(IORING_OP_READ_FIXED, fd, 0, URING_BUFFER_SIZE, 0)->off = -1;
+            n = uringRun(1) < 0 ? -1 : ring.results[0];
+        }
+        else if (offset < 0)
+        {
+            n = read(fd, buffer, sizeof(buffer));
+        }
+        while (n > 0 || (n < 0 && errno == EINTR && !uring))
+        {
+            const char *data = uring ? uringBuffer(slot) : buffer;
+            if (uring)
+            {
+                uringQueueFixed(IORING_OP_READ_FIXED, fd, slot ^ 1, URING_BUFFER_SIZE, 0)->off = -1;
+                uringRun(0);
+            }
+            if (n > 0)
+            {
+                wcCount((const unsigned char *)data, n, counts[i], &inWord, words);
+            }
+            if (uring)
+            {
+                n = uringRun(1) < 0 ? -1 : ring.results[0];
+                slot ^= 1;
+            }
+            else
+            {
+                n = read(fd, buffer, sizeof(buffer));
+            }
+        }
+        if (n < 0)
+        {
+            fprintf(stderr, "wc: %s: %s\n", name != NULL ? name : "standard input", strerror(uring ? -n : errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO)
+        {
+            close(fd);
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            counts[inputs][k] += counts[i][k];
+        }
+    }
+
+    if (inputs > 1 || lines + words + bytes > 1)
+    {
+        for (; regularTotal >= 10; regularTotal /= 10)
+        {
+            width++;
+        }
+        width = width < minimum ? minimum : width;
+    }
+    for (int i = 0; i <= inputs; i++)
+    {
+        if ((i < inputs && failed[i]) || (i == inputs && inputs == 1))
+        {
+            continue;
+        }
+        const char *separator = "";
+        int show[3] = {lines, words, bytes};
+        for (int k = 0; k < 3; k++)
+        {
+            if (show[k])
+            {
+                printf("%s%*llu", separator, width, (unsigned long long)counts[i][k]);
+                separator = " ";
+            }
+        }
+        if (i == inputs)
+            printf(" total");
+        else if (files > 0)
+            printf(" %s", args[first + i]);
+        printf("\n");
+    }
+    return status;
+}
+
+/*
+ * Adds the lines, words and bytes of data to counts, words as wc(1) in
+ * the C locale: blanks end a word, printable characters start one and
+ * other bytes do neither. With SSE2, 64 bytes become bit masks of
+ * newlines, blanks and printable characters; a word starts at each
+ * printable bit whose previous bit is not printable. Blocks with other
+ * bytes are counted one byte at a time. Without words only newlines are
+ * counted, in byte counters summed every 255 blocks.
+ */
+void wcCount(const unsigned char *data, size_t length, uint64_t counts[3], int *inWord, int words)
+{
+    size_t i = 0;
+    counts[2] += length;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+    while (!words && i + 16 <= length)
+    {
+        __m128i sum = zero;
+        size_t stop = length - i < 255 * 16 ? length - 15 : i + 255 * 16;
+        for (; i < stop; i += 16)
+        {
+            sum = _mm_sub_epi8(sum, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), newline));
+        }
+        sum = _mm_sad_epu8(sum, zero);
+        counts[0] += _mm_extract_epi16(sum, 0) + _mm_extract_epi16(sum, 4);
+    }
+
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), four = _mm_set1_epi8(4);
+    const __m128i bang = _mm_set1_epi8('!'), printable = _mm_set1_epi8('~' - '!');
+    for (; words && i + 64 <= length; i += 64)
+    {
+        uint64_t lineMask = 0, blankMask = 0, printMask = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i c = _mm_loadu_si128((const __m128i *)(data + i + 16 * k));
+            __m128i control = _mm_sub_epi8(c, tab); // \t to \r become 0 to 4
+            __m128i graphic = _mm_sub_epi8(c, bang);
+            __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+            __m128i print = _mm_cmpeq_epi8(_mm_min_epu8(graphic, printable), graphic);
+            lineMask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(c, newline)) << 16 * k;
+            blankMask |= (uint64_t)(unsigned)_mm_movemask_epi8(blank) << 16 * k;
+            printMask |= (uint64_t)(unsigned)_mm_movemask_epi8(print) << 16 * k;
+        }
+        counts[0] += __builtin_popcountll(lineMask);
+        if ((blankMask | printMask) == ~(uint64_t)0)
+        {
+            counts[1] += __builtin_popcountll(printMask & ~(printMask << 1 | (uint64_t)*inWord));
+            *inWord = printMask >> 63;
+            continue;
+        }
+        for (size_t k = i; k < i + 64; k++)
+        {
+            unsigned char c = data[k];
+            if (c == ' ' || (c >= '\t' && c <= '\r'))
+            {
+                *inWord = 0;
+            }
+            else if (c > ' ' && c < 0x7f)
+            {
+                counts[1] += !*inWord;
+                *inWord = 1;
+            }
+        }
+    }
+#endif
+    for (; i < length; i++)
+    {
+        unsigned char c = data[i];
+        counts[0] += c == '\n';
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+        {
+            *inWord = 0;
+        }
+        else if (c > ' ' && c < 0x7f)
+        {
+            counts[1] += !*inWord;
+            *inWord = 1;
+        }
+    }
+}
+
+/* Tells if the grep builtin handles args: -F, -E, -v, -c, -n, -i and -q before a pattern */
+int grepSupported(char *args[])
+{
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strspn(args[i] + 1, "FEvcniq") != strlen(args[i] + 1))
+        {
+            return 0;
+        }
+    }
+    return args[i] != NULL;
+}
+
+/* grep [-FEvcniq] pattern [file...] prints the lines that match, exits 0 when there were any */
+int grepCommand(char *args[])
+{
+    struct grepPattern pattern;
+    memset(&pattern, 0, sizeof(pattern));
+    int fixed = 0, extended = 0, i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        for (const char *option = args[i] + 1; *option != '\0'; option++)
+        {
+            fixed |= *option == 'F';
+            extended |= *option == 'E';
+            pattern.invert |= *option == 'v';
+            pattern.count |= *option == 'c';
+            pattern.number |= *option == 'n';
+            pattern.fold |= *option == 'i';
+            pattern.quiet |= *option == 'q';
+        }
+    }
+    const char *text = args[i++];
+    if (text == NULL || strlen(text) >= MAX_LINE)
+    {
+        fprintf(stderr, "Usage: grep [-FEvcniq] pattern [file...]\n");
+        return 2;
+    }
+
+    /* The longest literal finds candidate lines, the regex only checks those */
+    int plain = 1;
+    if (fixed)
+    {
+        pattern.literalLength = strlen(text);
+        memcpy(pattern.literal, text, pattern.literalLength);
+    }
+    else
+    {
+        pattern.literalLength = requiredLiteral(text, extended, pattern.literal, &plain);
+    }
+    if (!plain)
+    {
+        int flags = REG_NOSUB | (extended ? REG_EXTENDED : 0) | (pattern.fold ? REG_ICASE : 0);
+        int error = regcomp(&pattern.compiled, text, flags);
+        if (error != 0)
+        {
+            char message[256];
+            regerror(error, &pattern.compiled, message, sizeof(message));
+            fprintf(stderr, "grep: %s\n", message);
+            return 2;
+        }
+        pattern.regex = 1;
+    }
+    for (size_t k = 0; pattern.fold && k < pattern.literalLength; k++)
+    {
+        char c = pattern.literal[k];
+        pattern.literal[k] = c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+    }
+
+    pattern.names = args[i] != NULL && args[i + 1] != NULL;
+    long selected = 0;
+    int status = 0;
+    for (int first = i; args[i] != NULL || i == first; i++)
+    {
+        const char *name = args[i] != NULL ? args[i] : "(standard input)";
+        int fd = args[i] != NULL && strcmp(args[i], "-") != 0 ? open(args[i], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        long found = fd < 0 ? -1 : grepFd(fd, name, &pattern);
+        if (found < 0)
+        {
+            fprintf(stderr, "grep: %s: %s\n", name, strerror(errno));
+            status = 2;
+        }
+        else if (pattern.count && !pattern.quiet)
+        {
+            char line[64];
+            int length = snprintf(line, sizeof(line), "%ld\n", found);
+            grepEmit(&pattern, name, 0, line, length);
+        }
+        if (fd > STDIN_FILENO)
+        {
+            close(fd);
+        }
+        selected += found > 0 ? found : 0;
+        if (pattern.quiet && selected > 0)
+        {
+            break;
+        }
+        if (args[i] == NULL)
+        {
+            break;
+        }
+    }
+    grepFlush();
+    if (pattern.regex)
+    {
+        regfree(&pattern.compiled);
+    }
+    return selected > 0 && (status == 0 || pattern.quiet) ? 0 : status != 0 ? status : 1;
+}
+
+/*
+ * Copies the longest run of ordinary characters that every match of the
+ * regex must contain into literal and returns its length. Runs inside
+ * groups, and characters a *, ?, \? or {n,m} makes optional, do not count.
+ * An alternation at the top level means nothing is known. *plain is set
+ * when the pattern is one literal with nothing else around it.
+ */
+size_t requiredLiteral(const char *pattern, int extended, char *literal, int *plain)
+{
+    char run[MAX_LINE];
+    size_t best = 0, length = 0;
+    int depth = 0;
+    *plain = 1;
+    for (size_t i = 0; pattern[i] != '\0'; i++)
+    {
+        char c = pattern[i];
+        int ordinary = 0, optional = 0, interval = 0;
+        if (c == '\\' && pattern[i + 1] != '\0')
+        {
+            c = pattern[++i];
+            if (strchr(".[]*^$\\/", c) != NULL || (extended && strchr("+?{}()|", c) != NULL))
+            {
+                ordinary = 1; // An escaped special character
+            }
+            else if (!extended && (c == '(' || c == ')'))
+            {
+                depth += c == '(' ? 1 : -1;
+            }
+            else if (!extended && c == '|')
+            {
+                *plain = 0;
+                return 0;
+            }
+            else if (!extended && (c == '?' || c == '{'))
+            {
+                optional = 1;
+                interval = c == '{';
+            }
+        }
+        else if (extended && c == '|')
+        {
+            *plain = 0;
+            return 0;
+        }
+        else if (extended && (c == '(' || c == ')'))
+        {
+            depth += c == '(' ? 1 : -1;
+        }
+        else if (c == '*' || (extended && (c == '?' || c == '{')))
+        {
+            optional = 1;
+            interval = c == '{';
+        }
+        else if (c == '[')
+        {
+            /* A bracket expression is one unknown character, ] first is part of it */
+            i += pattern[i + 1] == '^';
+            i += pattern[i + 1] == ']';
+            while (pattern[i + 1] != '\0' && pattern[i + 1] != ']')
+            {
+                i++;
+            }
+            i += pattern[i + 1] == ']';
+        }
+        else if (c != '.' && c != '^' && c != '$' && !(extended && c == '+'))
+        {
+            ordinary = 1;
+        }
+
+        if (interval)
+        {
+            /* The bounds are not part of any literal, and {0,n} makes the atom before them optional */
+            const char *close = extended ? strchr(pattern + i + 1, '}') : strstr(pattern + i + 1, "\\}");
+            if (close == NULL)
+            {
+                *plain = 0;
+                return 0;
+            }
+            i = close - pattern + !extended;
+        }
+
+        *plain &= ordinary;
+        if (ordinary && depth == 0)
+        {
+            run[length++] = c;
+            continue;
+        }
+        if (optional && length > 0)
+        {
+            length--; // The character before it may be missing
+        }
+        if (length > best)
+        {
+            memcpy(literal, run, length);
+            best = length;
+        }
+        length = 0;
+    }
+    if (length > best)
+    {
+        memcpy(literal, run, length);
+        best = length;
+    }
+    return best;
+}
+
+/*
+ * Finds the first needle in haystack, NULL if there is none. memchr()
+ * jumps to the first byte of the needle while that byte is rare. When it
+ * stops too often, SSE2 compares the first and the last byte of the
+ * needle against 32 positions at once and checks the rest only where
+ * both agree. With fold the needle is lowercase and letters match either case.
+ */
+const char *findString(const char *haystack, size_t length, const char *needle, size_t needleLength, int fold)
+{
+    if (needleLength == 0)
+    {
+        return haystack;
+    }
+    if (length < needleLength)
+    {
+        return NULL;
+    }
+    unsigned char first = needle[0], last = needle[needleLength - 1];
+    size_t i = 0, end = length - needleLength; // Last possible start
+    for (size_t misses = 0; !fold && i <= end;)
+    {
+        const char *candidate = memchr(haystack + i, first, end - i + 1);
+        if (candidate == NULL)
+        {
+            return NULL;
+        }
+        if (memcmp(candidate, needle, needleLength) == 0)
+        {
+            return candidate;
+        }
+        i = candidate + 1 - haystack;
+        if (++misses >= 16 && misses * 64 > i)
+        {
+            break; // A false start every 64 bytes or more often
+        }
+    }
+#ifdef __SSE2__
+    /* Or-ing 0x20 makes letters lowercase, only for the bytes where the needle has a letter */
+    __m128i firstBytes = _mm_set1_epi8(first), lastBytes = _mm_set1_epi8(last);
+    __m128i firstFold = _mm_set1_epi8(fold && first >= 'a' && first <= 'z' ? 0x20 : 0);
+    __m128i lastFold = _mm_set1_epi8(fold && last >= 'a' && last <= 'z' ? 0x20 : 0);
+    for (; i + 32 <= end + 1; i += 32)
+    {
+        /* Two blocks per round, most rounds end at the test of both masks */
+        const char *lastByte = haystack + i + needleLength - 1;
+        __m128i a0 = _mm_or_si128(_mm_loadu_si128((const __m128i *)(haystack + i)), firstFold);
+        __m128i b0 = _mm_or_si128(_mm_loadu_si128((const __m128i *)lastByte), lastFold);
+        __m128i a1 = _mm_or_si128(_mm_loadu_si128((const __m128i *)(haystack + i + 16)), firstFold);
+        __m128i b1 = _mm_or_si128(_mm_loadu_si128((const __m128i *)(lastByte + 16)), lastFold);
+        __m128i m0 = _mm_and_si128(_mm_cmpeq_epi8(a0, firstBytes), _mm_cmpeq_epi8(b0, lastBytes));
+        __m128i m1 = _mm_and_si128(_mm_cmpeq_epi8(a1, firstBytes), _mm_cmpeq_epi8(b1, lastBytes));
+        if (_mm_movemask_epi8(_mm_or_si128(m0, m1)) == 0)
+        {
+            continue;
+        }
+        unsigned mask = _mm_movemask_epi8(m0) | (unsigned)_mm_movemask_epi8(m1) << 16;
+        while (mask != 0)
+        {
+            const char *candidate = haystack + i + __builtin_ctz(mask);
+            size_t k = 1;
+            while (k < needleLength && (fold ? (candidate[k] >= 'A' && candidate[k] <= 'Z' ? candidate[k] + 'a' - 'A' : candidate[k]) : candidate[k]) == needle[k])
+            {
+                k++;
+            }
+            if (k == needleLength)
+            {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i <= end; i++)
+    {
+        if (!fold)
+        {
+            const char *candidate = memchr(haystack + i, first, end - i + 1);
+            if (candidate == NULL)
+            {
+                return NULL;
+            }
+            i = candidate - haystack;
+            if (memcmp(candidate, needle, needleLength) == 0)
+            {
+                return candidate;
+            }
+            continue;
+        }
+        size_t k = 0;
+        while (k < needleLength && (haystack[i + k] >= 'A' && haystack[i + k] <= 'Z' ? haystack[i + k] + 'a' - 'A' : haystack[i + k]) == needle[k])
+        {
+            k++;
+        }
+        if (k == needleLength)
+        {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+/* Reads fd in large blocks and filters the complete lines of each, returns the lines selected or -1 */
+long grepFd(int fd, const char *name, struct grepPattern *pattern)
+{
+    size_t capacity = GREP_BUFFER, have = 0;
+    char *buffer = malloc(capacity);
+    unsigned long lineNumber = 1;
+    long selected = 0;
+    int done = 0;
+    while (!done && buffer != NULL)
+    {
+        ssize_t n = read(fd, buffer + have, capacity - have - 1); // One byte for a missing last newline
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            free(buffer);
+            return -1;
+        }
+        have += n;
+        done = n == 0;
+
+        size_t end = have;
+        if (done && have > 0 && buffer[have - 1] != '\n')
+        {
+            buffer[end++] = '\n';
+        }
+        else if (!done)
+        {
+            char *newline = memrchr(buffer, '\n', have);
+            if (newline == NULL)
+            {
+                if (have + 1 == capacity)
+                {
+                    capacity *= 2; // A line longer than the buffer
+                    char *grown = realloc(buffer, capacity);
+                    if (grown == NULL)
+                    {
+                        break;
+                    }
+                    buffer = grown;
+                }
+                continue;
+            }
+            end = newline + 1 - buffer;
+        }
+
+        selected += grepLines(buffer, end, pattern, name, &lineNumber);
+        if (pattern->quiet && selected > 0)
+        {
+            break;
+        }
+        have -= end < have ? end : have;
+        memmove(buffer, buffer + end, have);
+    }
+    free(buffer);
+    return selected;
+}
+
+/*
+ * Filters length bytes of complete lines. The literal is searched across
+ * line boundaries, so lines without it are skipped unseen; only the line
+ * around a hit is checked against the regex. Returns the lines selected.
+ */
+long grepLines(const char *data, size_t length, struct grepPattern *pattern, const char *name, unsigned long *lineNumber)
+{
+    const char *position = data, *end = data + length;
+    long selected = 0;
+    while (position < end)
+    {
+        const char *hit = findString(position, end - position, pattern->literal, pattern->literalLength, pattern->fold);
+        const char *lineStart = end;
+        if (hit != NULL)
+        {
+            lineStart = memrchr(position, '\n', hit - position);
+            lineStart = lineStart != NULL ? lineStart + 1 : position;
+        }
+
+        /* The lines before the hit do not match */
+        while (position < lineStart && (pattern->invert || pattern->number))
+        {
+            const char *next = (const char *)memchr(position, '\n', lineStart - position) + 1;
+            if (pattern->invert)
+            {
+                grepEmit(pattern, name, *lineNumber, position, next - position);
+                selected++;
+            }
+            ++*lineNumber;
+            position = next;
+        }
+        if (hit == NULL)
+        {
+            break;
+        }
+
+        const char *lineEnd = (const char *)memchr(hit, '\n', end - hit) + 1;
+        int match = 1;
+        if (pattern->regex)
+        {
+            regmatch_t range = {0, lineEnd - 1 - lineStart};
+            match = regexec(&pattern->compiled, lineStart, 1, &range, REG_STARTEND) == 0;
+        }
+        if (match != pattern->invert)
+        {
+            grepEmit(pattern, name, *lineNumber, lineStart, lineEnd - lineStart);
+            selected++;
+            if (pattern->quiet)
+            {
+                break;
+            }
+        }
+        ++*lineNumber;
+        position = lineEnd;
+    }
+    return selected;
+}
+
+/* Buffers a selected line with its file name and number, nothing for -c and -q */
+void grepEmit(struct grepPattern *pattern, const char *name, unsigned long lineNumber, const char *line, size_t length)
+{
+    if (pattern->quiet || (pattern->count && lineNumber != 0))
+    {
+        return;
+    }
+    char prefix[MAX_LINE + 32];
+    int prefixLength = 0;
+    if (pattern->names)
+    {
+        prefixLength = snprintf(prefix, sizeof(prefix), "%.*s:", MAX_LINE, name);
+    }
+    if (pattern->number && lineNumber != 0)
+    {
+        prefixLength += snprintf(prefix + prefixLength, sizeof(prefix) - prefixLength, "%lu:", lineNumber);
+    }
+    if (grepOutputUsed + prefixLength + length > sizeof(grepOutput))
+    {
+        grepFlush();
+    }
+    if (prefixLength + length > sizeof(grepOutput))
+    {
+        writeAll(STDOUT_FILENO, prefix, prefixLength, -1);
+        writeAll(STDOUT_FILENO, line, length, -1);
+        return;
+    }
+    memcpy(grepOutput + grepOutputUsed, prefix, prefixLength);
+    memcpy(grepOutput + grepOutputUsed + prefixLength, line, length);
+    grepOutputUsed += prefixLength + length;
+}
+
+/* Writes the buffered grep output to standard output */
+void grepFlush(void)
+{
+    writeAll(STDOUT_FILENO, grepOutput, grepOutputUsed, -1);
+    grepOutputUsed = 0;
+}
+
+/* Tells if the sort builtin handles args: -n, -r and -u, then files */
+int sortSupported(char *args[])
+{
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strspn(args[i] + 1, "nru") != strlen(args[i] + 1))
+        {
+            return 0;
+        }
+    }
+    for (; args[i] != NULL; i++)
+    {
+        if (args[i][0] == '-' && args[i][1] != '\0')
+        {
+            return 0; // sort(1) also takes options after the files
+        }
+    }
+    return 1;
+}
+
+/*
+ * sort [-nru] [file...] sorts lines bytewise or by leading number. Regular
+ * files, standard input redirected with < included, are mapped instead of
+ * read. Up to SORT_MEMORY bytes of lines are sorted by several threads;
+ * past that each batch becomes a sorted run in an unlinked temp file and
+ * the runs are merged at the end.
+ */
+int sortCommand(char *args[])
+{
+    int i = 1;
+    sortNumeric = sortReverse = sortUnique = 0;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        sortNumeric |= strchr(args[i], 'n') != NULL;
+        sortReverse |= strchr(args[i], 'r') != NULL;
+        sortUnique |= strchr(args[i], 'u') != NULL;
+    }
+
+    struct sortState state;
+    memset(&state, 0, sizeof(state));
+    struct
+    {
+        void *data;
+        size_t size;
+    } maps[MAX_ARGS];
+    int mapCount = 0, status = 0;
+
+    for (int first = i; args[i] != NULL || i == first; i++)
+    {
+        const char *name = args[i] != NULL ? args[i] : "-";
+        int fd = strcmp(name, "-") != 0 ? open(name, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            fprintf(stderr, "sort: %s: %s\n", name, strerror(errno));
+            status = 2;
+            break;
+        }
+
+        off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+        if (offset >= 0 && st.st_size > offset && mapCount < MAX_ARGS)
+        {
+            /* The lines point straight into the page cache */
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                fprintf(stderr, "sort: %s: %s\n", name, strerror(errno));
+                status = 2;
+            }
+            else
+            {
+                madvise(data, st.st_size, MADV_WILLNEED);
+                maps[mapCount].data = data;
+                maps[mapCount++].size = st.st_size;
+
+                /* Pieces of SORT_MEMORY cut after a newline, each may become a run */
+                const char *text = (char *)data + offset, *end = (char *)data + st.st_size;
+                while (text < end && status == 0)
+                {
+                    const char *cut = end - text > SORT_MEMORY ? memchr(text + SORT_MEMORY, '\n', end - text - SORT_MEMORY) : NULL;
+                    cut = cut != NULL ? cut + 1 : end;
+                    if (sortAddText(&state, text, cut - text) < 0 || (state.bytes >= SORT_MEMORY && sortSpill(&state) < 0))
+                    {
+                        status = 2;
+                    }
+                    text = cut;
+                }
+                if (fd == STDIN_FILENO)
+                {
+                    lseek(fd, st.st_size, SEEK_SET); // Consumed, as if it had been read
+                }
+            }
+        }
+        else
+        {
+            /* A pipe: blocks of SORT_BLOCK, a line cut at the end moves to the next block */
+            size_t carry = 0;
+            char *block = NULL, *previous = NULL;
+            for (;;)
+            {
+                block = malloc(SORT_BLOCK + carry);
+                if (block == NULL)
+                {
+                    status = 2;
+                    break;
+                }
+                if (carry > 0)
+                {
+                    memcpy(block, previous, carry);
+                }
+                size_t have = carry;
+                ssize_t n = 0;
+                while (have < SORT_BLOCK + carry && (n = read(fd, block + have, SORT_BLOCK + carry - have)) != 0)
+                {
+                    if (n < 0 && errno != EINTR)
+                        break;
+                    have += n > 0 ? n : 0;
+                }
+                if (n < 0)
+                {
+                    fprintf(stderr, "sort: %s: %s\n", name, strerror(errno));
+                    free(block);
+                    status = 2;
+                    break;
+                }
+                if (state.blockCount == state.blockCapacity)
+                {
+                    state.blockCapacity = state.blockCapacity > 0 ? state.blockCapacity * 2 : 16;
+                    state.blocks = realloc(state.blocks, state.blockCapacity * sizeof(char *));
+                }
+                state.blocks[state.blockCount++] = block;
+
+                char *newline = n == 0 ? NULL : memrchr(block, '\n', have);
+                size_t whole = n == 0 ? have : newline != NULL ? (size_t)(newline + 1 - block) : 0;
+                carry = have - whole;
+                previous = block + whole;
+                if (whole > 0 && sortAddText(&state, block, whole) < 0)
+                {
+                    status = 2;
+                    break;
+                }
+                if (n == 0)
+                {
+                    break;
+                }
+                if (state.bytes >= SORT_MEMORY && sortSpill(&state) < 0)
+                {
+                    status = 2; // The carried line still sits in the last block, which the spill keeps
+                    break;
+                }
+            }
+        }
+        if (fd > STDIN_FILENO)
+        {
+            close(fd);
+        }
+        if (status != 0 || (state.bytes >= SORT_MEMORY && sortSpill(&state) < 0))
+        {
+            status = 2;
+            break;
+        }
+        if (args[i] == NULL)
+        {
+            break;
+        }
+    }
+
+    if (status == 0)
+    {
+        struct sortCursor cursors[SORT_MAX_RUNS + SORT_THREADS];
+        void *runMaps[SORT_MAX_RUNS];
+        size_t runSizes[SORT_MAX_RUNS];
+        int count = 0, mapped = 0;
+        if (state.runCount > 0 && state.count > 0 && sortSpill(&state) < 0)
+        {
+            status = 2;
+        }
+        else if (state.runCount == 0)
+        {
+            count = sortParallel(state.lines, state.count, cursors);
+        }
+        else
+        {
+            count = sortOpenRuns(&state, cursors, runMaps, runSizes);
+            mapped = count >= 0;
+            status = mapped ? 0 : 2;
+        }
+        if (status == 0 && sortMerge(cursors, count, STDOUT_FILENO) < 0)
+        {
+            fprintf(stderr, "sort: write error: %s\n", strerror(errno));
+            status = 2;
+        }
+        for (int r = 0; r < state.runCount && mapped; r++)
+        {
+            if (runSizes[r] > 0)
+                munmap(runMaps[r], runSizes[r]);
+        }
+    }
+
+    for (int r = 0; r < state.runCount; r++)
+    {
+        close(state.runs[r]); // Unlinked, so this frees their space
+    }
+    for (int m = 0; m < mapCount; m++)
+    {
+        munmap(maps[m].data, maps[m].size);
+    }
+    for (int b = 0; b < state.blockCount; b++)
+    {
+        free(state.blocks[b]);
+    }
+    free(state.blocks);
+    free(state.lines);
+    return status;
+}
+
+/* Adds the lines of text, the last one may lack its newline; -1 when out of memory */
+int sortAddText(struct sortState *state, const char *text, size_t length)
+{
+    const char *end = text + length;
+    while (text < end)
+    {
+        const char *newline = memchr(text, '\n', end - text);
+        const char *lineEnd = newline != NULL ? newline : end;
+        if (state->count == state->capacity)
+        {
+            size_t capacity = state->capacity > 0 ? state->capacity * 2 : 4096;
+            struct sortLine *lines = realloc(state->lines, capacity * sizeof(struct sortLine));
+            if (lines == NULL)
+            {
+                fprintf(stderr, "sort: out of memory\n");
+                return -1;
+            }
+            state->lines = lines;
+            state->capacity = capacity;
+        }
+        state->lines[state->count].text = text;
+        state->lines[state->count].order = state->added++;
+        state->lines[state->count++].length = lineEnd - text;
+        state->bytes += lineEnd - text + 1;
+        text = lineEnd + 1;
+    }
+    return 0;
+}
+
+/* Sorts the gathered lines into a new run file and frees the blocks they came from */
+int sortSpill(struct sortState *state)
+{
+    struct sortCursor parts[SORT_MAX_RUNS + SORT_THREADS];
+    int fd = sortTempFile();
+    if (fd < 0)
+    {
+        fprintf(stderr, "sort: cannot create a temp file: %s\n", strerror(errno));
+        return -1;
+    }
+    int count = sortParallel(state->lines, state->count, parts);
+    if (sortMerge(parts, count, fd) < 0)
+    {
+        fprintf(stderr, "sort: cannot write a run: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* The last block may hold the start of a line that is not complete yet */
+    for (int b = 0; b + 1 < state->blockCount; b++)
+    {
+        free(state->blocks[b]);
+    }
+    if (state->blockCount > 0)
+    {
+        state->blocks[0] = state->blocks[state->blockCount - 1];
+        state->blockCount = 1;
+    }
+    state->count = state->bytes = 0;
+    state->runs[state->runCount++] = fd;
+
+    if (state->runCount == SORT_MAX_RUNS)
+    {
+        /* Too many runs to merge at once, they become one */
+        void *maps[SORT_MAX_RUNS];
+        size_t sizes[SORT_MAX_RUNS];
+        int merged = sortTempFile();
+        int count = sortOpenRuns(state, parts, maps, sizes);
+        int failed = count < 0 || merged < 0 || sortMerge(parts, count, merged) < 0;
+        for (int r = 0; r < state->runCount && count >= 0; r++)
+        {
+            if (sizes[r] > 0)
+                munmap(maps[r], sizes[r]);
+        }
+        if (failed)
+        {
+            fprintf(stderr, "sort: cannot merge runs: %s\n", strerror(errno));
+            return -1;
+        }
+        for (int r = 0; r < state->runCount; r++)
+        {
+            close(state->runs[r]);
+        }
+        state->runs[0] = merged;
+        state->runCount = 1;
+    }
+    return 0;
+}
+
+/* Maps every run file and sets up a cursor on each; returns the cursors with lines, -1 on error */
+int sortOpenRuns(struct sortState *state, struct sortCursor *cursors, void **maps, size_t *sizes)
+{
+    int count = 0;
+    for (int r = 0; r < state->runCount; r++)
+    {
+        struct stat st;
+        maps[r] = MAP_FAILED;
+        sizes[r] = fstat(state->runs[r], &st) == 0 ? st.st_size : 0;
+        if (sizes[r] > 0 && (maps[r] = mmap(NULL, sizes[r], PROT_READ, MAP_PRIVATE, state->runs[r], 0)) == MAP_FAILED)
+        {
+            for (int k = 0; k < r; k++)
+            {
+                if (sizes[k] > 0)
+                    munmap(maps[k], sizes[k]);
+            }
+            return -1;
+        }
+        if (sizes[r] > 0)
+        {
+            madvise(maps[r], sizes[r], MADV_SEQUENTIAL);
+            cursors[count] = (struct sortCursor){{NULL, 0, 0}, NULL, NULL, maps[r], (char *)maps[r] + sizes[r]};
+            count += sortAdvance(&cursors[count]);
+        }
+    }
+    return count;
+}
+
+/* Arguments of one sorting thread */
+struct sortPart
+{
+    struct sortLine *lines;
+    size_t count;
+};
+
+/*
+ * Sorts lines in up to SORT_THREADS parts at once, one per processor, and
+ * fills parts with a cursor over each sorted part for sortMerge().
+ * Returns the number of parts.
+ */
+int sortParallel(struct sortLine *lines, size_t count, struct sortCursor *parts)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = processors > 0 ? (size_t)processors : 1;
+    threads = threads > SORT_THREADS ? SORT_THREADS : threads;
+    threads = count / 16384 + 1 < threads ? count / 16384 + 1 : threads; // Small inputs are not worth a thread
+
+    pthread_t ids[SORT_THREADS];
+    struct sortPart work[SORT_THREADS];
+    size_t started = 0;
+    for (size_t t = 0; t < threads; t++)
+    {
+        work[t].lines = lines + count * t / threads;
+        work[t].count = count * (t + 1) / threads - count * t / threads;
+        if (t == 0 || pthread_create(&ids[t], NULL, sortThread, &work[t]) != 0)
+        {
+            continue; // Sorted below, in this thread
+        }
+        started |= (size_t)1 << t;
+    }
+    for (size_t t = 0; t < threads; t++)
+    {
+        if (!(started & ((size_t)1 << t)))
+        {
+            sortThread(&work[t]);
+        }
+    }
+    int used = 0;
+    for (size_t t = 0; t < threads; t++)
+    {
+        if (started & ((size_t)1 << t))
+        {
+            pthread_join(ids[t], NULL);
+        }
+        parts[used] = (struct sortCursor){{NULL, 0, 0}, work[t].lines, work[t].lines + work[t].count, NULL, NULL};
+        used += sortAdvance(&parts[used]);
+    }
+    return used;
+}
+
+/* Thread body: sorts one part in place */
+void *sortThread(void *part)
+{
+    struct sortPart *work = part;
+    qsort(work->lines, work->count, sizeof(struct sortLine), compareLines);
+    return NULL;
+}
+
+/* Moves a cursor to its next line, returns 0 when it has none */
+int sortAdvance(struct sortCursor *cursor)
+{
+    if (cursor->next != NULL)
+    {
+        if (cursor->next == cursor->end)
+        {
+            return 0;
+        }
+        cursor->line = *cursor->next++;
+        return 1;
+    }
+    if (cursor->text == NULL || cursor->text >= cursor->textEnd)
+    {
+        return 0;
+    }
+    const char *newline = memchr(cursor->text, '\n', cursor->textEnd - cursor->text);
+    const char *end = newline != NULL ? newline : cursor->textEnd;
+    cursor->line.text = cursor->text;
+    cursor->line.length = end - cursor->text;
+    cursor->text = end + 1;
+    return 1;
+}
+
+/*
+ * Merges count sorted cursors into fd with a binary heap of cursors,
+ * dropping repeated lines for -u. Returns -1 if a write failed.
+ */
+int sortMerge(struct sortCursor *cursors, int count, int fd)
+{
+    struct sortOutput *out = malloc(sizeof(struct sortOutput));
+    struct sortCursor *heap[SORT_MAX_RUNS + SORT_THREADS];
+    struct sortLine last = {NULL, 0, 0};
+    int written = 0;
+    if (out == NULL)
+    {
+        return -1;
+    }
+    out->fd = fd;
+    out->used = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        /* Sift up */
+        int child = i;
+        heap[child] = &cursors[i];
+        while (child > 0 && compareCursors(heap[(child - 1) / 2], heap[child]) > 0)
+        {
+            struct sortCursor *swap = heap[child];
+            heap[child] = heap[(child - 1) / 2];
+            heap[(child - 1) / 2] = swap;
+            child = (child - 1) / 2;
+        }
+    }
+
+    while (count > 0)
+    {
+        struct sortCursor *top = heap[0];
+        if (!sortUnique || !written || compareKeys(&last, &top->line) != 0)
+        {
+            sortWrite(out, top->line.text, top->line.length);
+            sortWrite(out, "\n", 1);
+            last = top->line;
+            written = 1;
+        }
+        if (!sortAdvance(top))
+        {
+            heap[0] = heap[--count];
+        }
+
+        /* Sift down */
+        for (int parent = 0;;)
+        {
+            int child = parent * 2 + 1;
+            if (child >= count)
+            {
+                break;
+            }
+            if (child + 1 < count && compareCursors(heap[child + 1], heap[child]) < 0)
+            {
+                child++;
+            }
+            if (compareCursors(heap[parent], heap[child]) <= 0)
+            {
+                break;
+            }
+            struct sortCursor *swap = heap[child];
+            heap[child] = heap[parent];
+            heap[parent] = swap;
+            parent = child;
+        }
+    }
+
+    int result = writeAll(out->fd, out->data, out->used, -1);
+    free(out);
+    return result;
+}
+
+/* Buffers sort output and writes it out in 64 KiB pieces */
+void sortWrite(struct sortOutput *out, const char *data, size_t length)
+{
+    if (out->used + length > sizeof(out->data))
+    {
+        writeAll(out->fd, out->data, out->used, -1); // Errors show up again in the last write
+        out->used = 0;
+    }
+    if (length > sizeof(out->data))
+    {
+        writeAll(out->fd, data, length, -1);
+        return;
+    }
+    memcpy(out->data + out->used, data, length);
+    out->used += length;
+}
+
+/* A file for a run: O_TMPFILE in $TMPDIR or /tmp, so nothing is left behind */
+int sortTempFile(void)
+{
+    const char *dir = getVariable("TMPDIR");
+    dir = dir != NULL && dir[0] != '\0' ? dir : "/tmp";
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR))
+    {
+        return fd;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/sort-XXXXXX", dir);
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0)
+    {
+        unlink(path);
+    }
+    return fd;
+}
+
+/* compareKeys(), then input order, so lines -n -u considers equal keep their order */
+int compareLines(const void *a, const void *b)
+{
+    const struct sortLine *x = a, *y = b;
+    int order = compareKeys(x, y);
+    return order != 0 ? order : (x->order > y->order) - (x->order < y->order);
+}
+
+/* Lines of run files carry no order, the cursors are in input order instead */
+int compareCursors(const struct sortCursor *a, const struct sortCursor *b)
+{
+    int order = compareLines(&a->line, &b->line);
+    return order != 0 ? order : (a > b) - (a < b);
+}
+
+/* Bytewise order, or numeric with -n and then bytewise; -r reverses both, -u drops the bytewise tie break */
+int compareKeys(const struct sortLine *x, const struct sortLine *y)
+{
+    int order = 0;
+    if (sortNumeric)
+    {
+        order = compareNumbers(x->text, x->length, y->text, y->length);
+    }
+    if (order == 0 && !(sortNumeric && sortUnique))
+    {
+        size_t shorter = x->length < y->length ? x->length : y->length;
+        order = memcmp(x->text, y->text, shorter);
+        if (order == 0)
+        {
+            order = (x->length > y->length) - (x->length < y->length);
+        }
+    }
+    return sortReverse ? -order : order;
+}
+
+/*
+ * Compares the numbers at the start of two lines like sort -n: blanks,
+ * an optional minus sign, digits and a fraction. Digits are compared as
+ * text, so any length works. A line without a number counts as zero.
+ */
+int compareNumbers(const char *a, size_t aLength, const char *b, size_t bLength)
+{
+    const char *text[2] = {a, b};
+    size_t length[2] = {aLength, bLength};
+    const char *integer[2], *fraction[2];
+    size_t integerLength[2], fractionLength[2];
+    int negative[2];
+    for (int k = 0; k < 2; k++)
+    {
+        const char *p = text[k], *end = text[k] + length[k];
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        negative[k] = p < end && *p == '-';
+        p += negative[k];
+        while (p < end && *p == '0')
+            p++; // Leading zeros do not count
+        integer[k] = p;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+        integerLength[k] = p - integer[k];
+        fraction[k] = p + (p < end && *p == '.');
+        p = fraction[k];
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+        fractionLength[k] = p - fraction[k];
+        while (fractionLength[k] > 0 && fraction[k][fractionLength[k] - 1] == '0')
+            fractionLength[k]--; // Nor do trailing zeros
+        if (integerLength[k] == 0 && fractionLength[k] == 0)
+            negative[k] = 0; // -0 is 0
+    }
+
+    int order;
+    if (negative[0] != negative[1])
+    {
+        return negative[0] ? -1 : 1;
+    }
+    if (integerLength[0] != integerLength[1])
+    {
+        order = integerLength[0] < integerLength[1] ? -1 : 1;
+    }
+    else
+    {
+        order = memcmp(integer[0], integer[1], integerLength[0]);
+        size_t shorter = fractionLength[0] < fractionLength[1] ? fractionLength[0] : fractionLength[1];
+        if (order == 0)
+            order = memcmp(fraction[0], fraction[1], shorter);
+        if (order == 0)
+            order = (fractionLength[0] > fractionLength[1]) - (fractionLength[0] < fractionLength[1]);
+    }
+    return negative[0] ? -order : order;
+}
+
+/*
+ * Sets up the io_uring ring on first use, and again in a forked child so
+ * it never shares one with the shell. Returns 0 when MYSHELL_IO=rw or the
+ * kernel refuses io_uring, and the caller uses read() and write().
+ */
+int uringReady(void)
+{
+    const char *backend = getVariable("MYSHELL_IO");
+    if (backend != NULL && strcmp(backend, "rw") == 0)
+    {
+        return 0;
+    }
+    if (ring.fd >= 0 && ring.owner == getpid())
+    {
+        return 1;
+    }
+    if (ring.fd == -2)
+    {
+        return 0;
+    }
+    if (ring.fd >= 0)
+    {
+        /* Inherited from the shell */
+        if (ring.cqRing != ring.sqRing)
+            munmap(ring.cqRing, ring.cqRingSize);
+        munmap(ring.sqRing, ring.sqRingSize);
+        munmap(ring.sqes, URING_ENTRIES * sizeof(struct io_uring_sqe));
+        close(ring.fd);
+    }
+    ring.fd = -2;
+    ring.queued = ring.inFlight = 0;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0)
+    {
+        return 0; // ENOSYS, or disabled by sysctl or seccomp
+    }
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(fd); // Before 5.6, without offset -1 and IORING_OP_OPENAT
+        return 0;
+    }
+
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring.sqRingSize = ring.cqRingSize = ring.sqRingSize > ring.cqRingSize ? ring.sqRingSize : ring.cqRingSize;
+    }
+    ring.sqRing = mmap(NULL, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring.cqRing = ring.sqRing;
+    if (ring.sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring.cqRing = mmap(NULL, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    ring.sqes = mmap(NULL, URING_ENTRIES * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.buffers == NULL)
+    {
+        ring.buffers = mmap(NULL, URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    struct iovec iov[URING_BUFFERS];
+    for (int i = 0; i < URING_BUFFERS; i++)
+    {
+        iov[i].iov_base = uringBuffer(i);
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (ring.sqRing == MAP_FAILED || ring.cqRing == MAP_FAILED || ring.sqes == MAP_FAILED || ring.buffers == MAP_FAILED ||
+        syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, URING_BUFFERS) < 0)
+    {
+        close(fd); // The mappings go with it when the process exits, this only happens once
+        ring.buffers = ring.buffers == MAP_FAILED ? NULL : ring.buffers;
+        return 0;
+    }
+
+    char *sq = ring.sqRing, *cq = ring.cqRing;
+    ring.sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring.sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring.cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring.cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring.fd = fd;
+    ring.owner = getpid();
+    return 1;
+}
+
+/* Fills the next submission entry with opcode on fd, its result lands in ring.results[tag] */
+struct io_uring_sqe *uringQueue(int opcode, int fd, int tag)
+{
+    unsigned index = (*ring.sqTail + ring.queued++) & *ring.sqMask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    ring.sqArray[index] = index;
+    return sqe;
+}
+
+/* READ_FIXED or WRITE_FIXED of length bytes in registered buffer slot, at offset 0 unless the caller sets off */
+struct io_uring_sqe *uringQueueFixed(int opcode, int fd, int slot, unsigned length, int tag)
+{
+    struct io_uring_sqe *sqe = uringQueue(opcode, fd, tag);
+    sqe->addr = (uintptr_t)uringBuffer(slot);
+    sqe->len = length;
+    sqe->buf_index = slot;
+    return sqe;
+}
+
+/* Registered buffer number slot */
+char *uringBuffer(int slot)
+{
+    return ring.buffers + (size_t)slot * URING_BUFFER_SIZE;
+}
+
+/*
+ * Submits everything queued and waits until wait completions, counting
+ * ones reaped by earlier calls that were not waited for, are in
+ * ring.results[]. One io_uring_enter() covers both in the common case.
+ */
+int uringRun(unsigned wait)
+{
+    unsigned submit = ring.queued;
+    __atomic_store_n(ring.sqTail, *ring.sqTail + submit, __ATOMIC_RELEASE);
+    ring.queued = 0;
+    ring.inFlight += submit;
+    unsigned target = ring.inFlight - (wait < ring.inFlight ? wait : ring.inFlight); // In flight once we are done
+    for (;;)
+    {
+        unsigned head = *ring.cqHead;
+        while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head++ & *ring.cqMask];
+            if (cqe->user_data < URING_ENTRIES)
+            {
+                ring.results[cqe->user_data] = cqe->res;
+            }
+            ring.inFlight--;
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+        if (submit == 0 && ring.inFlight <= target)
+        {
+            return 0;
+        }
+
+        unsigned waitFor = ring.inFlight > target ? ring.inFlight - target : 0;
+        int n = syscall(__NR_io_uring_enter, ring.fd, submit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        submit -= n > 0 ? ((unsigned)n < submit ? (unsigned)n : submit) : 0;
+    }
+}
+
+/*
+ * cat of several files into out with a handful of system calls per batch
+ * of URING_BUFFERS files: one io_uring_enter() opens them, one reads the
+ * first buffer of each and one writes them out in order and closes them.
+ * A file that fills its buffer is finished with copyFd() before the files
+ * after it are written. Returns the exit status of cat.
+ */
+int uringCat(char *paths[], int count, int out)
+{
+    struct stat outStat;
+    int seekable = fstat(out, &outStat) == 0 && S_ISREG(outStat.st_mode) && !(fcntl(out, F_GETFL) & O_APPEND);
+    off_t outOffset = seekable ? lseek(out, 0, SEEK_CUR) : -1;
+    int status = 0;
+
+    for (int first = 0; first < count; first += URING_BUFFERS)
+    {
+        int batch = count - first < URING_BUFFERS ? count - first : URING_BUFFERS;
+        int fds[URING_BUFFERS], lengths[URING_BUFFERS];
+        off_t offsets[URING_BUFFERS];
+
+        for (int i = 0; i < batch; i++)
+        {
+            struct io_uring_sqe *sqe = uringQueue(IORING_OP_OPENAT, AT_FDCWD, i);
+            sqe->addr = (uintptr_t)paths[first + i];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        if (uringRun(batch) < 0)
+        {
+            return 1;
+        }
+        int reads = 0;
+        for (int i = 0; i < batch; i++)
+        {
+            fds[i] = ring.results[i];
+            if (fds[i] < 0)
+            {
+                fprintf(stderr, "cat: %s: %s\n", paths[first + i], strerror(-fds[i]));
+                status = 1;
+                continue;
+            }
+            uringQueueFixed(IORING_OP_READ_FIXED, fds[i], i, URING_BUFFER_SIZE, i);
+            reads++;
+        }
+        if (uringRun(reads) < 0)
+        {
+            return 1;
+        }
+
+        for (int i = 0; i < batch;)
+        {
+            /* Write in order up to and including the first file that is not finished */
+            int end = i, writes = 0, closes = 0;
+            struct io_uring_sqe *last = NULL;
+            for (; end < batch; end++)
+            {
+                if (fds[end] < 0)
+                {
+                    continue;
+                }
+                lengths[end] = ring.results[end];
+                if (lengths[end] < 0)
+                {
+                    fprintf(stderr, "cat: %s: %s\n", paths[first + end], strerror(-lengths[end]));
+                    status = 1;
+                    lengths[end] = 0;
+                }
+                offsets[end] = outOffset;
+                if (lengths[end] > 0)
+                {
+                    last = uringQueueFixed(IORING_OP_WRITE_FIXED, out, end, lengths[end], URING_BUFFERS + end);
+                    last->off = seekable ? (uint64_t)outOffset : (uint64_t)-1;
+                    last->flags = seekable ? 0 : IOSQE_IO_LINK; // The file position orders nothing, the link does
+                    outOffset += seekable ? lengths[end] : 0;
+                    writes++;
+                }
+                if (lengths[end] == URING_BUFFER_SIZE)
+                {
+                    break; // Maybe more to read
+                }
+            }
+            if (last != NULL)
+            {
+                last->flags = 0; // Ends the chain
+            }
+            for (int j = i; j < end; j++)
+            {
+                if (fds[j] >= 0)
+                {
+                    uringQueue(IORING_OP_CLOSE, fds[j], URING_ENTRIES); // Result not kept
+                    closes++;
+                }
+            }
+            if (uringRun(writes + closes) < 0)
+            {
+                return 1;
+            }
+
+            /* Short writes and writes canceled behind them are finished in order */
+            for (int j = i; j < end + (end < batch); j++)
+            {
+                if (fds[j] < 0 || lengths[j] == 0)
+                {
+                    continue;
+                }
+                int written = ring.results[URING_BUFFERS + j];
+                if (written == -ECANCELED)
+                {
+                    written = 0; // Linked behind a short write
+                }
+                if (written < 0 ||
+                    writeAll(out, uringBuffer(j) + written, lengths[j] - written, seekable ? offsets[j] + written : -1) < 0)
+                {
+                    fprintf(stderr, "cat: write error: %s\n", strerror(written < 0 ? -written : errno));
+                    return 1;
+                }
+            }
+
+            if (end < batch)
+            {
+                /* A large file: the rest goes through the kernel */
+                lseek(fds[end], URING_BUFFER_SIZE, SEEK_SET);
+                if (seekable)
+                {
+                    lseek(out, outOffset, SEEK_SET);
+                }
+                if (copyFd(fds[end], out) < 0)
+                {
+                    fprintf(stderr, "cat: %s: %s\n", paths[first + end], strerror(errno));
+                    status = 1;
+                }
+                outOffset = seekable ? lseek(out, 0, SEEK_CUR) : -1;
+                close(fds[end]);
+            }
+            i = end + 1;
+        }
+    }
+    if (seekable)
+    {
+        lseek(out, outOffset, SEEK_SET);
+    }
+    return status;
+}
+
+/*
+ * Copies in to every descriptor in outs, up to length bytes or end of
+ * file for -1, through two registered buffers: the writes of one chunk
+ * and the read of the next go in with the same io_uring_enter().
+ */
+int uringStream(int in, int outs[], int outCount, off_t length)
+{
+    int slot = 0, status = 0;
+    unsigned chunk = length >= 0 && length < URING_BUFFER_SIZE ? length : URING_BUFFER_SIZE;
+    uringQueueFixed(IORING_OP_READ_FIXED, in, slot, chunk, 0)->off = -1;
+    if (uringRun(1) < 0)
+    {
+        return -1;
+    }
+    int n = ring.results[0];
+    while (n > 0)
+    {
+        if (length > 0)
+        {
+            length -= n;
+        }
+        for (int i = 0; i < outCount && i < URING_ENTRIES - 1; i++)
+        {
+            uringQueueFixed(IORING_OP_WRITE_FIXED, outs[i], slot, n, i + 1)->off = -1;
+        }
+        chunk = length >= 0 && length < URING_BUFFER_SIZE ? length : URING_BUFFER_SIZE;
+        if (chunk > 0)
+        {
+            uringQueueFixed(IORING_OP_READ_FIXED, in, slot ^ 1, chunk, 0)->off = -1;
+        }
+        if (uringRun(outCount + (chunk > 0)) < 0)
+        {
+            return -1;
+        }
+        for (int i = 0; i < outCount; i++)
+        {
+            int written = ring.results[i + 1];
+            if (written < 0 || writeAll(outs[i], uringBuffer(slot) + written, n - written, -1) < 0)
+            {
+                errno = written < 0 ? -written : errno;
+                status = -1; // tee keeps writing to the others
+            }
+        }
+        n = chunk > 0 ? ring.results[0] : 0;
+        slot ^= 1;
+    }
+    if (n < 0)
+    {
+        errno = -n;
+        return -1;
+    }
+    return status;
+}
+
+/* Writes all of data, at offset unless it is -1, and returns -1 on error */
+int writeAll(int fd, const char *data, size_t length, off_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t n = offset < 0 ? write(fd, data, length) : pwrite(fd, data, length, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        data += n;
+        length -= n;
+        offset += offset < 0 ? 0 : n;
+    }
+    return 0;
+}
+
+/* Hands out 16 byte aligned memory that stays valid until arenaReset() */
+void *arenaAlloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    while (arenaCurrent == NULL || arenaCurrent->used + size > arenaCurrent->size)
+    {
+        if (arenaCurrent != NULL && arenaCurrent->next != NULL)
+        {
+            arenaCurrent = arenaCurrent->next; // Reuse a block from an earlier line
+            arenaCurrent->used = 0;
+            continue;
+        }
+
+        size_t blockSize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        struct arenaBlock *block = malloc(sizeof(struct arenaBlock) + blockSize);
+        if (block == NULL)
+        {
+            fprintf(stderr, "Out of memory for arguments\n");
+            exit(1);
+        }
+        block->next = NULL;
+        block->used = 0;
+        block->size = blockSize;
+        if (arenaCurrent == NULL)
+        {
+            arenaFirst = block;
+        }
+        else
+        {
+            arenaCurrent->next = block;
+        }
+        arenaCurrent = block;
+    }
+
+    void *memory = arenaCurrent->data + arenaCurrent->used;
+    arenaCurrent->used += size;
+    return memory;
+}
+
+/* Starts handing out the arena from the beginning again */
+void arenaReset(void)
+{
+    while (captures != NULL)
+    {
+        if (captures->mapped)
+        {
+            munmap(captures->data, captures->size);
+        }
+        else
+        {
+            free(captures->data);
+        }
+        captures = captures->next; // The entry itself is in the arena
+    }
+    hereDocCount = 0;
+    arenaCurrent = arenaFirst;
+    if (arenaCurrent != NULL)
+    {
+        arenaCurrent->used = 0;
+    }
+}
+
+/* Copies length bytes of text into the arena as a string */
+char *arenaString(const char *text, size_t length)
+{
+    char *copy = arenaAlloc(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* Appends to a NULL terminated argv, doubling it inside the arena when full */
+void argListAdd(struct argList *list, char *item)
+{
+    if (list->count + 1 >= list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char **items = arenaAlloc(capacity * sizeof(char *));
+        if (list->count > 0)
+        {
+            memcpy(items, list->items, list->count * sizeof(char *));
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = item;
+    list->items[list->count] = NULL;
+}
+
+/* Expands command substitutions, then globs, into an arena argv */
+char **expandArguments(char *words[])
+{
+    struct argList argv = {NULL, 0, 0};
+    for (int i = 0, depth = 0; words[i] != NULL; i++)
+    {
+        /* Words of a group in a pipe are expanded when the group's own commands run */
+        int inside = depth > 0;
+        depth = groupDepth(words, i, depth);
+        if (inside || depth > 0)
+        {
+            argListAdd(&argv, words[i]);
+            continue;
+        }
+
+        size_t length = strlen(words[i]);
+        if ((words[i][0] == '<' || words[i][0] == '>') && words[i][1] == '(' && words[i][length - 1] == ')')
+        {
+            argListAdd(&argv, processSubstitution(words[i]));
+            continue;
+        }
+        if (strstr(words[i], "$(") == NULL && strchr(words[i], '`') == NULL)
+        {
+            globWord(words[i], &argv);
+            continue;
+        }
+
+        struct argList fields = {NULL, 0, 0};
+        substituteWord(words[i], &fields);
+        for (int j = 0; j < fields.count; j++)
+        {
+            globWord(fields.items[j], &argv);
+        }
+    }
+    if (argv.items == NULL)
+    {
+        argListAdd(&argv, NULL); // Only the terminator
+        argv.count = 0;
+    }
+    return argv.items;
+}
+
+/* Replaces a word with a * ? or [ pattern by the paths it matches, a word without a match stays as typed */
+void globWord(char *word, struct argList *out)
+{
+    if (strpbrk(word, "*?[") == NULL)
+    {
+        argListAdd(out, word);
+        return;
+    }
+
+    double start = nowMicros();
+    int before = out->count;
+    char path[PATH_MAX];
+    globPath(path, 0, word, out);
+    if (out->count == before)
+    {
+        argListAdd(out, word);
+    }
+    traceEvent("glob", 'X', start, nowMicros(), word);
+}
+
+/* Index of the ) closing the $( or ( at text[i], or of the ` closing the one at text[i]; -1 if unterminated */
+int substitutionEnd(const char *text, int i, int length)
+{
+    if (text[i] == '`')
+    {
+        for (int j = i + 1; j < length; j++)
+        {
+            if (text[j] == '`')
+                return j;
+        }
+        return -1;
+    }
+
+    int depth = 0;
+    for (int j = i + 1; j < length; j++)
+    {
+        if (text[j] == '(')
+        {
+            depth++;
+        }
+        else if (text[j] == ')' && --depth == 0)
+        {
+            return j;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Runs command in a subshell and returns its output without the trailing
+ * newlines. The output is read from a pipe into a growing buffer; past
+ * CAPTURE_MEMFD_SIZE it moves to a memfd that the rest is spliced into and
+ * that is then mapped, so large outputs are not copied through the heap.
+ */
+char *captureOutput(const char *command, size_t length)
+{
+    double start = nowMicros();
+    int pipefd[2];
+    if (length >= MAX_LINE || pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        fprintf(stderr, "Command substitution failed\n");
+        return NULL;
+    }
+
+    pid_t pid = forkShell();
+    if (pid < 0)
+    {
+        fprintf(stderr, "Fork failed");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return NULL;
+    }
+    if (pid == 0)
+    {
+        dup2(pipefd[1], STDOUT_FILENO);
+        runSubshell(command, length);
+    }
+    close(pipefd[1]);
+
+    struct capture *capture = arenaAlloc(sizeof(struct capture));
+    size_t used = 0, capacity = 4096;
+    char *buffer = malloc(capacity);
+    int memfd = -1;
+    ssize_t bytes;
+    for (;;)
+    {
+        if (memfd == -1)
+        {
+            if (used + 1 == capacity)
+            {
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+            }
+            bytes = read(pipefd[0], buffer + used, capacity - used - 1);
+        }
+        else
+        {
+            bytes = splice(pipefd[0], NULL, memfd, NULL, CAPTURE_MEMFD_SIZE, SPLICE_F_MOVE);
+        }
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            break;
+        }
+        used += bytes;
+
+        if (memfd == -1 && used >= CAPTURE_MEMFD_SIZE)
+        {
+            memfd = memfd_create("substitution", MFD_CLOEXEC);
+            if (memfd >= 0 && write(memfd, buffer, used) != (ssize_t)used)
+            {
+                close(memfd);
+                memfd = -1;
+            }
+            if (memfd >= 0)
+            {
+                free(buffer);
+                buffer = NULL;
+            }
+        }
+    }
+    close(pipefd[0]);
+    waitForeground(pid);
+
+    capture->mapped = memfd >= 0;
+    if (capture->mapped)
+    {
+        capture->size = used + 1; // Room for the terminating NUL
+        if (ftruncate(memfd, capture->size) < 0 ||
+            (buffer = mmap(NULL, capture->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED)
+        {
+            fprintf(stderr, "Command substitution failed\n");
+            close(memfd);
+            return NULL;
+        }
+        close(memfd);
+    }
+    else
+    {
+        capture->size = capacity;
+    }
+    capture->data = buffer;
+    capture->next = captures;
+    captures = capture;
+
+    while (used > 0 && buffer[used - 1] == '\n')
+    {
+        used--;
+    }
+    buffer[used] = '\0';
+    traceEvent("substitution", 'X', start, nowMicros(), buffer);
+    return buffer;
+}
+
+/*
+ * Expands the $(...) and `...` parts of word and splits their output at
+ * blanks and newlines. Fields are NUL terminated in the output buffer
+ * itself; only a field glued to text around the substitution is copied.
+ */
+void substituteWord(char *word, struct argList *out)
+{
+    char *pending = NULL; // Field being built, NULL until it has content
+    size_t pendingLength = 0;
+    int length = strlen(word);
+    int i = 0;
+
+    while (i < length)
+    {
+        /* Literal text up to the next substitution */
+        int j = i;
+        int end = -1;
+        while (j < length)
+        {
+            if ((word[j] == '$' && word[j + 1] == '(') || word[j] == '`')
+            {
+                end = substitutionEnd(word, j, length);
+                if (end != -1)
+                    break;
+            }
+            j++;
+        }
+        if (j > i)
+        {
+            char *joined = arenaAlloc(pendingLength + j - i + 1);
+            if (pending != NULL)
+                memcpy(joined, pending, pendingLength);
+            memcpy(joined + pendingLength, word + i, j - i);
+            pendingLength += j - i;
+            joined[pendingLength] = '\0';
+            pending = joined;
+        }
+        if (j == length)
+        {
+            break;
+        }
+
+        int skip = word[j] == '$' ? 2 : 1;
+        char *output = captureOutput(word + j + skip, end - j - skip);
+        i = end + 1;
+        if (output == NULL)
+        {
+            continue;
+        }
+
+        /* Blanks around the output end the fields it touches */
+        size_t outputLength = strlen(output);
+        int leadingBlank = outputLength > 0 && strchr(" \t\n", output[0]) != NULL;
+        int trailingBlank = outputLength > 0 && strchr(" \t\n", output[outputLength - 1]) != NULL;
+        if (leadingBlank && pending != NULL)
+        {
+            argListAdd(out, pending);
+            pending = NULL;
+            pendingLength = 0;
+        }
+
+        /* Split in place, a first field right at the start joins the pending text */
+        char *saveptr;
+        for (char *field = strtok_r(output, " \t\n", &saveptr); field != NULL; field = strtok_r(NULL, " \t\n", &saveptr))
+        {
+            if (pending != NULL && field == output)
+            {
+                size_t fieldLength = strlen(field);
+                char *joined = arenaAlloc(pendingLength + fieldLength + 1);
+                memcpy(joined, pending, pendingLength);
+                memcpy(joined + pendingLength, field, fieldLength + 1);
+                pending = joined;
+                pendingLength += fieldLength;
+                continue;
+            }
+            if (pending != NULL)
+            {
+                argListAdd(out, pending);
+            }
+            pending = field;
+            pendingLength = strlen(field);
+        }
+        if (trailingBlank && pending != NULL)
+        {
+            argListAdd(out, pending);
+            pending = NULL;
+            pendingLength = 0;
+        }
+    }
+
+    if (pending != NULL)
+    {
+        argListAdd(out, pending);
+    }
+}
+
+/* Puts one end of a pipe on a stage's stdin or stdout and closes both originals */
+void connectStage(int pipefd[2], int target)
+{
+    int end = target == STDOUT_FILENO ? pipefd[1] : pipefd[0];
+    close(target == STDOUT_FILENO ? pipefd[0] : pipefd[1]); // The other end is not used
+    dup2(end, target);
+    close(end);
+}
+
+/* Parses a copy of command in a subshell and runs it, its last command execs in place */
+void runSubshell(const char *command, size_t length)
+{
+    char line[MAX_LINE];
+    char *args[MAX_LINE / 2 + 1];
+    int count = 0;
+    memcpy(line, command, length);
+    parseLine(line, length, args);
+    while (args[count] != NULL)
+    {
+        count++;
+    }
+    exit(executeList(args, 0, count, 1));
+}
+
+/*
+ * Starts the command of <(command) or >(command) as a pipeline stage
+ * running next to the outer command, and returns /dev/fd/N naming the
+ * shell's end of the pipe. The end stays open, without close-on-exec,
+ * until the outer command has been started.
+ */
+char *processSubstitution(const char *word)
+{
+    size_t length = strlen(word) - 3; // Without <( and )
+    int output = word[0] == '<';      // <(command) is read from, >(command) written to
+    int pipefd[2];
+    if (procSubCount == MAX_PROC_SUBS || length >= MAX_LINE || pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        fprintf(stderr, "Process substitution failed\n");
+        return (char *)word;
+    }
+
+    pid_t pid = forkShell();
+    if (pid == 0)
+    {
+        connectStage(pipefd, output ? STDOUT_FILENO : STDIN_FILENO);
+        runSubshell(word + 2, length);
+    }
+    int end = output ? pipefd[0] : pipefd[1];
+    close(output ? pipefd[1] : pipefd[0]);
+    if (pid < 0)
+    {
+        fprintf(stderr, "Fork failed");
+        close(end);
+        return (char *)word;
+    }
+
+    fcntl(end, F_SETFD, 0); // Inherited by the outer command
+    procSubFds[procSubCount++] = end;
+    char *path = arenaAlloc(32);
+    snprintf(path, 32, "/dev/fd/%d", end);
+    return path;
+}
+
+/* Closes the shell's ends of the process substitutions opened since first */
+void closeSubstitutions(int first)
+{
+    while (procSubCount > first)
+    {
+        close(procSubFds[--procSubCount]);
+    }
+}
+
+/*
+ * Moves the redirections out of args[] into list, in order, and returns
+ * how many there are, or -1 after reporting a syntax error. A redirection
+ * is [n]<, [n]>, [n]>>, [n]>&m, [n]<&m, [n]>&-, &>, &>>, <<, <<- or <<<,
+ * with its target attached or in the next word.
+ */
+int parseRedirections(char *args[], struct redirection list[])
+{
+    int count = 0, kept = 0;
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        const char *p = args[i];
+        int fd = -1, both = 0;
+        if (p[0] == '&' && p[1] == '>')
+        {
+            both = 1; // &> file is > file 2>&1
+            p++;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9' && fd < 1000)
+            {
+                fd = (fd < 0 ? 0 : fd * 10) + *p++ - '0';
+            }
+        }
+        if (*p != '<' && *p != '>')
+        {
+            args[kept++] = args[i]; // An ordinary word
+            continue;
+        }
+        if (count + 2 > MAX_REDIRECTIONS)
+        {
+            fprintf(stderr, "Too many redirections.\n");
+            return -1;
+        }
+
+        struct redirection *r = &list[count++];
+        r->kind = REDIRECT_FILE;
+        r->operator = args[i];
+        r->target = NULL;
+        r->fd = fd >= 0 ? fd : *p == '<' ? STDIN_FILENO : STDOUT_FILENO;
+        if (strcmp(p, "<<") == 0 || strcmp(p, "<<-") == 0 || strcmp(p, "<<<") == 0)
+        {
+            r->kind = REDIRECT_HEREDOC;
+            p += strlen(p);
+        }
+        else if (*p++ == '<')
+        {
+            r->flags = O_RDONLY;
+        }
+        else if (*p == '>')
+        {
+            r->flags = O_WRONLY | O_CREAT | O_APPEND;
+            p++;
+        }
+        else
+        {
+            r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+            p += *p == '|'; // >| is > as there is no noclobber
+        }
+
+        if (*p == '&' && !both && r->kind == REDIRECT_FILE)
+        {
+            /* Duplicate or close a descriptor, never a file name */
+            p++;
+            if (*p == '\0' && args[i + 1] != NULL)
+            {
+                p = args[++i]; // echo x>& 2 split by parseLine()
+            }
+            r->source = 0;
+            r->kind = strcmp(p, "-") == 0 ? REDIRECT_CLOSE : REDIRECT_DUP;
+            for (const char *digit = p; r->kind == REDIRECT_DUP; digit++)
+            {
+                if (*digit == '\0' && digit != p)
+                    break;
+                if (*digit < '0' || *digit > '9')
+                {
+                    fprintf(stderr, "Bad file descriptor in '%s'.\n", args[i]);
+                    return -1;
+                }
+                r->source = r->source * 10 + *digit - '0';
+            }
+            continue;
+        }
+
+        r->target = *p != '\0' ? p : args[++i];
+        if (r->target == NULL)
+        {
+            fprintf(stderr, "Missing argument.\n");
+            return -1;
+        }
+        if (both)
+        {
+            struct redirection *err = &list[count++];
+            err->kind = REDIRECT_DUP;
+            err->fd = STDERR_FILENO;
+            err->source = STDOUT_FILENO;
+            err->operator = r->operator;
+            err->target = NULL;
+        }
+    }
+    args[kept] = NULL;
+    return count;
+}
+
+/*
+ * Applies redirections in one pass, left to right: each target is opened
+ * close-on-exec and moved onto its descriptor with dup3(), so nothing is
+ * left behind for the command. With saved != NULL the descriptors they
+ * replace are kept there for restoreRedirections().
+ */
+int applyRedirections(struct redirection list[], int count, int saved[])
+{
+    if (saved != NULL)
+    {
+        fflush(NULL); // Buffered output belongs to the old descriptors
+        for (int i = 0; i < count; i++)
+        {
+            saved[i] = -2; // Not applied (yet)
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        struct redirection *r = &list[i];
+        if (saved != NULL)
+        {
+            saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, 10); // -1 if it was closed
+        }
+
+        int source;
+        switch (r->kind)
+        {
+        case REDIRECT_CLOSE:
+            close(r->fd);
+            continue;
+        case REDIRECT_DUP:
+        case REDIRECT_OPENED:
+            source = r->source;
+            if (fcntl(source, F_GETFD) < 0)
+            {
+                fprintf(stderr, "%d: Bad file descriptor\n", source);
+                return -1;
+            }
+            break;
+        case REDIRECT_HEREDOC:
+            source = openHereDoc(r->operator, r->target);
+            if (source < 0)
+            {
+                return -1;
+            }
+            break;
+        default:
+            source = open(r->target, r->flags | O_CLOEXEC, 0644);
+            if (source < 0)
+            {
+                fprintf(stderr, "Error opening %s: %s\n", r->target, strerror(errno));
+                return -1;
+            }
+        }
+
+        if (source == r->fd)
+        {
+            fcntl(r->fd, F_SETFD, 0); // Already in place, only keep it across exec
+        }
+        else
+        {
+            int moved = dup3(source, r->fd, 0);
+            int error = errno;
+            if (r->kind != REDIRECT_DUP && r->kind != REDIRECT_OPENED)
+            {
+                close(source);
+            }
+            if (moved < 0)
+            {
+                fprintf(stderr, "%d: %s\n", r->fd, strerror(error)); // Past RLIMIT_NOFILE, for one
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Puts back the descriptors a builtin's redirections replaced, newest first */
+void restoreRedirections(struct redirection list[], int count, int saved[])
+{
+    fflush(NULL);
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (saved[i] == -2)
+        {
+            continue;
+        }
+        if (saved[i] >= 0)
+        {
+            dup2(saved[i], list[i].fd);
+            close(saved[i]);
+        }
+        else
+        {
+            close(list[i].fd);
+        }
+    }
+}
+
+/*
+ * Returns an O_APPEND descriptor for path from a small LRU cache, or -1 if
+ * it cannot be opened. A hit costs one stat() to check that the path
+ * still names the same (dev, ino), so a log that was rotated or removed
+ * is opened again instead of written behind the user's back.
+ */
+int appendFd(const char *path)
+{
+    struct stat st;
+    int exists = stat(path, &st) == 0;
+    struct appendEntry *slot = &appendCache[0];
+    for (int i = 0; i < APPEND_CACHE_SIZE; i++)
+    {
+        struct appendEntry *entry = &appendCache[i];
+        if (entry->path != NULL && exists && entry->dev == st.st_dev && entry->ino == st.st_ino)
+        {
+            STAT_ADD(appendHits, 1);
+            entry->lastUsed = ++appendClock;
+            if (strcmp(entry->path, path) != 0)
+            {
+                free(entry->path); // Another name for the same file
+                entry->path = strdup(path);
+            }
+            return entry->fd;
+        }
+        if (entry->lastUsed < slot->lastUsed)
+        {
+            slot = entry;
+        }
+    }
+
+    if (exists && !S_ISREG(st.st_mode))
+    {
+        return -1; // Devices and fifos are opened per command
+    }
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    STAT_ADD(appendMisses, 1);
+
+    /* Keep it out of the way of descriptors users redirect by number */
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, APPEND_FD_BASE);
+    close(fd);
+    if (high < 0)
+    {
+        return -1;
+    }
+
+    if (slot->path != NULL)
+    {
+        close(slot->fd);
+        free(slot->path);
+    }
+    slot->path = strdup(path);
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->fd = high;
+    slot->lastUsed = ++appendClock;
+    return high;
+}
+
+/* Replaces >> file redirections with cached descriptors, looked up in the shell so the cache outlives the child */
+void resolveAppends(struct redirection list[], int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (list[i].kind == REDIRECT_FILE && (list[i].flags & O_APPEND))
+        {
+            int fd = appendFd(list[i].target);
+            if (fd >= 0)
+            {
+                list[i].kind = REDIRECT_DUP;
+                list[i].source = fd;
+            }
+        }
+    }
+}
+
+/* Reads one line of standard input into buffer and keeps what follows it for the next call; returns its length, 0 at the end of input */
+int readInput(char *buffer, int size)
+{
+    int length = pendingLength;
+    memcpy(buffer, pendingInput, length);
+    pendingLength = 0;
+
+    for (;;)
+    {
+        char *newline = memchr(buffer, '\n', length);
+        if (newline != NULL)
+        {
+            int lineLength = newline - buffer + 1;
+            pendingLength = length - lineLength;
+            memcpy(pendingInput, newline + 1, pendingLength);
+            return lineLength;
+        }
+        if (length == size)
+        {
+            return length; // Longer than the buffer, the rest comes as the next line
+        }
+
+        int bytes = read(STDIN_FILENO, buffer + length, size - length);
+        if (bytes <= 0)
+        {
+            return length > 0 ? length : bytes;
+        }
+        length += bytes;
+    }
+}
+
+/* Next line of a here-document body without its newline, from the running script or standard input; NULL at the end of input */
+const char *readBodyLine(size_t *length)
+{
+    if (scriptText != NULL)
+    {
+        if (scriptPosition >= scriptLength)
+        {
+            return NULL;
+        }
+        const char *start = scriptText + scriptPosition;
+        const char *end = memchr(start, '\n', scriptLength - scriptPosition);
+        *length = (end != NULL ? end : scriptText + scriptLength) - start;
+        scriptPosition += *length + 1;
+        return start;
+    }
+
+    static char line[MAX_LINE];
+    int bytes;
+    if (isatty(STDIN_FILENO))
+    {
+        printf("> ");
+        fflush(stdout);
+    }
+    while ((bytes = readInput(line, MAX_LINE - 1)) < 0 && errno == EINTR)
+        ;
+    if (bytes <= 0)
+    {
+        return NULL;
+    }
+    recordLine(line, bytes);
+    *length = line[bytes - 1] == '\n' ? bytes - 1 : bytes;
+    return line;
+}
+
+/* Reads the body of every << and <<- on a parsed line, up to its delimiter line */
+void collectHereDocs(char *args[])
+{
+    for (int i = 0; args[i] != NULL; i++)
+    {
+        int stripTabs = strcmp(args[i], "<<-") == 0;
+        if ((strcmp(args[i], "<<") != 0 && !stripTabs) || args[i + 1] == NULL)
+        {
+            continue;
+        }
+        if (hereDocCount == MAX_HERE_DOCS)
+        {
+            fprintf(stderr, "Too many here-documents on one line\n");
+            return;
+        }
+
+        /* Quotes around the delimiter are dropped, bodies are never expanded */
+        const char *delimiter = args[i + 1];
+        size_t delimiterLength = strlen(delimiter);
+        if (delimiterLength >= 2 && (delimiter[0] == '\'' || delimiter[0] == '"') && delimiter[delimiterLength - 1] == delimiter[0])
+        {
+            delimiter++;
+            delimiterLength -= 2;
+        }
+
+        size_t used = 0, capacity = 4096;
+        char *body = malloc(capacity);
+        const char *line;
+        size_t lineLength;
+        while ((line = readBodyLine(&lineLength)) != NULL)
+        {
+            while (stripTabs && lineLength > 0 && line[0] == '\t')
+            {
+                line++;
+                lineLength--;
+            }
+            if (lineLength == delimiterLength && memcmp(line, delimiter, lineLength) == 0)
+            {
+                break;
+            }
+            if (used + lineLength + 1 > capacity)
+            {
+                capacity = (used + lineLength + 1) * 2;
+                body = realloc(body, capacity);
+            }
+            memcpy(body + used, line, lineLength);
+            used += lineLength;
+            body[used++] = '\n';
+        }
+        if (line == NULL)
+        {
+            fprintf(stderr, "Here-document ended by end of input, wanted '%.*s'\n", (int)delimiterLength, delimiter);
+        }
+
+        /* Released at the next line like the command substitution buffers */
+        struct capture *capture = arenaAlloc(sizeof(struct capture));
+        capture->data = body;
+        capture->size = capacity;
+        capture->mapped = 0;
+        capture->next = captures;
+        captures = capture;
+
+        hereDocs[hereDocCount].delimiter = args[i + 1];
+        hereDocs[hereDocCount].body = body;
+        hereDocs[hereDocCount].length = used;
+        hereDocCount++;
+    }
+}
+
+/*
+ * Returns a readable fd holding text, plus a newline if asked. A pipe is
+ * enough when everything fits in its buffer, larger payloads go into a
+ * memfd that is sealed before the command sees it. Nothing touches disk.
+ */
+int hereDocFd(const char *text, size_t length, int newline)
+{
+    int fd, pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == 0)
+    {
+        int capacity = fcntl(pipefd[1], F_GETPIPE_SZ);
+        if (capacity > 0 && length + newline <= (size_t)capacity)
+        {
+            /* The pipe is empty and big enough, these writes cannot block */
+            if ((length > 0 && write(pipefd[1], text, length) != (ssize_t)length) ||
+                (newline && write(pipefd[1], "\n", 1) != 1))
+            {
+                fprintf(stderr, "Error writing the here-document\n");
+            }
+            close(pipefd[1]);
+            return pipefd[0];
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
+    fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error creating the here-document\n");
+        return -1;
+    }
+    size_t written = 0;
+    while (written < length)
+    {
+        ssize_t bytes = write(fd, text + written, length - written);
+        if (bytes <= 0)
+        {
+            fprintf(stderr, "Error writing the here-document\n");
+            close(fd);
+            return -1;
+        }
+        written += bytes;
+    }
+    if (newline)
+    {
+        write(fd, "\n", 1);
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/* fd to read for <<, <<- (the body collected for word) or <<< (word itself) */
+int openHereDoc(const char *operator, const char *word)
+{
+    if (strcmp(operator, "<<<") == 0)
+    {
+        return hereDocFd(word, strlen(word), 1);
+    }
+    for (int i = 0; i < hereDocCount; i++)
+    {
+        if (hereDocs[i].delimiter == word)
+        {
+            return hereDocFd(hereDocs[i].body, hereDocs[i].length, 0);
+        }
+    }
+    fprintf(stderr, "No here-document body for '%s'\n", word);
+    return -1;
+}
+
+/* Matches one path component against a pattern of * ? and [...] */
+int globMatch(const char *pattern, const char *name)
+{
+    const char *starPattern = NULL, *starName = NULL;
+    while (*name != '\0')
+    {
+        if (*pattern == '*')
+        {
+            starPattern = ++pattern; // Remember where to retry from
+            starName = name;
+            continue;
+        }
+        if (*pattern == '[')
+        {
+            const char *p = pattern + 1;
+            int negate = *p == '!' || *p == '^';
+            int matched = 0;
+            p += negate;
+            while (*p != '\0')
+            {
+                if (p[1] == '-' && p[2] != ']' && p[2] != '\0')
+                {
+                    matched |= *name >= p[0] && *name <= p[2];
+                    p += 3;
+                }
+                else
+                {
+                    matched |= *name == *p++;
+                }
+                if (*p == ']')
+                {
+                    break; // End of the set, a leading ] was taken as a member
+                }
+            }
+            if (*p == ']' && matched != negate)
+            {
+                pattern = p + 1;
+                name++;
+                continue;
+            }
+            if (*p != ']' && *name == '[')
+            {
+                pattern++; // No closing bracket, a plain [
+                name++;
+                continue;
+            }
+        }
+        else if (*pattern == '?' || (*pattern != '\0' && *pattern == *name))
+        {
+            pattern++;
+            name++;
+            continue;
+        }
+
+        if (starPattern == NULL)
+        {
+            return 0;
+        }
+        pattern = starPattern; // Let the last * swallow one more character
+        name = ++starName;
+    }
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/* Orders listing names for qsort() */
+int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Returns the sorted listing of a directory, read with getdents64 and
+ * cached under its (dev, ino, mtime). A directory modified less than a
+ * second before it was read may change again within the same mtime, so
+ * that listing is used once and not kept.
+ */
+struct globListing *readListing(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        return NULL;
+    }
+
+    struct globListing *slot = &globCache[0];
+    for (int i = 0; i < GLOB_CACHE_SIZE; i++)
+    {
+        struct globListing *entry = &globCache[i];
+        if (entry->valid && entry->dev == st.st_dev && entry->ino == st.st_ino &&
+            entry->mtime.tv_sec == st.st_mtim.tv_sec && entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            STAT_ADD(globHits, 1);
+            entry->lastUsed = ++globClock;
+            return entry;
+        }
+        if (entry->lastUsed < slot->lastUsed)
+        {
+            slot = entry;
         }
     }
 
-    /* Ensure args ends with NULL */
-    if (args[ct] != NULL)
-        args[ct] = NULL;
-
-    if (args[0] == NULL)
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
     {
-        fprintf(stderr, "Error: Invalid command in history.\n");
-        return;
+        return NULL;
     }
+    STAT_ADD(globMisses, 1);
 
-    addToHistory(args, historyBuffer, background); // Add to history
-
-    int hasPipe = 0;
-    for (int i = 0; args[i] != NULL; i++)
+    /* Names are packed into one buffer, offsets become pointers once it stops moving */
+    static char dents[65536];
+    size_t length = 0, capacity = 4096;
+    char *buffer = malloc(capacity);
+    int count = 0;
+    long bytes;
+    while ((bytes = syscall(SYS_getdents64, fd, dents, sizeof(dents))) > 0)
     {
-        if (strcmp(args[i], "|") == 0)
+        for (long offset = 0; offset < bytes;)
         {
-            hasPipe = 1;
-            break;
+            struct
+            {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            } *entry = (void *)(dents + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+            size_t nameLength = strlen(name) + 1;
+            if (length + nameLength > capacity)
+            {
+                capacity = capacity * 2 + nameLength;
+                buffer = realloc(buffer, capacity);
+            }
+            memcpy(buffer + length, name, nameLength);
+            length += nameLength;
+            count++;
         }
     }
+    close(fd);
 
-    if (hasPipe)
+    free(slot->names);
+    free(slot->buffer);
+    slot->buffer = buffer;
+    slot->count = count;
+    slot->names = malloc((count + 1) * sizeof(char *));
+    char *name = buffer;
+    for (int i = 0; i < count; i++)
     {
-        executePipedCommands(args, historyLine);
-        return;
+        slot->names[i] = name;
+        name += strlen(name) + 1;
     }
-    if (redirect(args, background))
+    qsort(slot->names, count, sizeof(char *), compareNames);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim;
+    slot->valid = now.tv_sec - st.st_mtim.tv_sec > 1;
+    slot->lastUsed = ++globClock;
+    return slot;
+}
+
+/* Adds the paths matching pattern below path[0..length) to out, one component at a time */
+void globPath(char *path, size_t length, const char *pattern, struct argList *out)
+{
+    while (*pattern == '/')
     {
-        return;
+        if (length + 1 >= PATH_MAX)
+            return;
+        path[length++] = *pattern++;
     }
+    const char *slash = strchr(pattern, '/');
+    size_t componentLength = slash != NULL ? (size_t)(slash - pattern) : strlen(pattern);
+    path[length] = '\0';
 
-    /* Fork and execute */
-    pid_t pid = fork();
-    if (pid < 0)
+    char component[NAME_MAX + 1];
+    if (componentLength > NAME_MAX)
     {
-        fprintf(stderr, "Fork failed");
         return;
     }
+    memcpy(component, pattern, componentLength);
+    component[componentLength] = '\0';
 
-    if (pid == 0)
+    /* Literal components are appended without reading the directory */
+    if (strpbrk(component, "*?[") == NULL)
     {
-        /* Child process */
-        char fullPath[MAX_LINE] = {0};
-        findCommandPath(args[0], fullPath);
-
-        if (fullPath[0] == '\0')
+        if (length + componentLength + 1 >= PATH_MAX)
+            return;
+        memcpy(path + length, component, componentLength + 1);
+        if (slash != NULL)
         {
-            fprintf(stderr, "Command not found: %s\n", args[0]);
-            exit(1);
+            globPath(path, length + componentLength, slash, out);
         }
-
-        if (execv(fullPath, args) == -1)
+        else if (access(path, F_OK) == 0)
         {
-            fprintf(stderr, "Command execution failed");
-            exit(1);
+            argListAdd(out, arenaString(path, length + componentLength));
         }
+        return;
     }
-    else
+
+    struct globListing *listing = readListing(length > 0 ? path : ".");
+    if (listing == NULL)
     {
-        /* Parent process */
-        if (background)
+        return;
+    }
+
+    /* Matches first: the listing can be replaced while recursing into them */
+    struct argList matches = {NULL, 0, 0};
+    for (int i = 0; i < listing->count; i++)
+    {
+        char *name = listing->names[i];
+        if (name[0] == '.' && component[0] != '.')
         {
-            bgProcesses[bgCount++] = pid;
-            printf("Process %d running in background\n", pid);
+            continue; // Hidden files only match patterns starting with a dot
         }
-        else
+        if (globMatch(component, name))
         {
-            fg_pid = pid;
-            waitpid(pid, NULL, 0); // Wait for child
-            fg_pid = -1;
+            argListAdd(&matches, slash != NULL ? arenaString(name, strlen(name)) : name);
         }
     }
-}
-
-/* Adds a command to the history buffer */
-void addToHistory(char *args[], char historyBuffer[MAX_HISTORY][MAX_LINE], int background)
-{
-    char inputBuffer[MAX_LINE] = {0};
 
-    /* Reconstruct the command */
-    for (int i = 0; args[i] != NULL; i++)
+    for (int i = 0; i < matches.count; i++)
     {
-        strcat(inputBuffer, args[i]);
-        if (args[i + 1] != NULL)
+        const char *name = matches.items[i];
+        size_t nameLength = strlen(name);
+        if (length + nameLength + 1 >= PATH_MAX)
         {
-            strcat(inputBuffer, " ");
+            continue;
         }
-    }
-    if (background)
-    {
-        strcat(inputBuffer, " &");
-    }
-
-    /* Shift history */
-    for (int i = MAX_HISTORY - 1; i > 0; i--)
-    {
-        strncpy(historyBuffer[i], historyBuffer[i - 1], MAX_LINE);
-    }
-
-    /* Add new command */
-    strncpy(historyBuffer[0], inputBuffer, MAX_LINE);
-}
-
-/* Prints the command history */
-void printHistory(char historyBuffer[MAX_HISTORY][MAX_LINE])
-{
-    for (int i = 0; i < MAX_HISTORY; i++)
-    {
-        if (historyBuffer[i][0] != '\0')
+        memcpy(path + length, name, nameLength + 1);
+        if (slash != NULL)
         {
-            printf("%d. %s\n", i, historyBuffer[i]);
+            globPath(path, length + nameLength, slash, out);
+        }
+        else
+        {
+            argListAdd(out, arenaString(path, length + nameLength));
         }
     }
 }
 
-/* Brings a background process to the foreground */
-void moveToForeground(pid_t pid, pid_t bgProcesses[MAX_BG_PROCESSES], int *bgCount)
+/* Strings and entries loaded from the snapshot are not owned by malloc() */
+int fromSnapshot(const void *pointer)
 {
-    int found = 0;
-    for (int i = 0; i < *bgCount; i++)
-    {
-        if (bgProcesses[i] == pid)
-        {
-            found = 1;
-            fg_pid = pid;                  // Set as foreground process
-            waitpid(pid, NULL, WUNTRACED); // Wait for process
-            fg_pid = -1;
-            /* Remove from background processes */
-            for (int j = i; j < *bgCount - 1; j++)
-            {
-                bgProcesses[j] = bgProcesses[j + 1];
-            }
-            (*bgCount)--;
-            break;
-        }
-    }
-    if (!found)
+    const char *p = pointer;
+    if (snapshotBase != NULL && p >= snapshotBase && p < snapshotBase + snapshotSize)
     {
-        printf("Process with PID %d not found in background processes.\n", pid);
+        return 1;
     }
+    return snapshotAliases != NULL && p >= (char *)snapshotAliases &&
+           p < (char *)(snapshotAliases + snapshotAliasCount);
 }
 
-/* Executes piped commands */
-void executePipedCommands(char *args[], char *inputBuffer)
+/* Maps the snapshot and points the history, path cache and alias table at it */
+void snapshotLoad(void)
 {
-    int pipefd[2];
-    pid_t pid1, pid2;
-
-    /* Split commands at pipe */
-    char *cmd1[MAX_LINE / 2 + 1];
-    char *cmd2[MAX_LINE / 2 + 1];
-    int cmd1_len = 0, cmd2_len = 0;
-    int pipeIndex = -1;
-
-    for (int i = 0; args[i] != NULL; i++)
+    if (snapshotPath == NULL)
     {
-        if (strcmp(args[i], "|") == 0)
-        {
-            pipeIndex = i;
-            break;
-        }
+        return;
     }
 
-    if (pipeIndex == -1)
+    int fd = open(snapshotPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        fprintf(stderr, "Error: No pipe found in command.\n");
-        return;
+        return; // First run
     }
-    // Each element of args up to pipeIndex is copied into the cmd1 array.
-    for (int i = 0; i < pipeIndex; i++)
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct snapshotHeader) || st.st_size > UINT32_MAX)
     {
-        cmd1[cmd1_len++] = args[i];
+        close(fd);
+        return; // No header field is read from a file too short to hold one
     }
-    cmd1[cmd1_len] = NULL;
-    // Each element of args after pipeIndex is copied into the cmd2 array.
-    for (int i = pipeIndex + 1; args[i] != NULL; i++)
+    char *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
     {
-        cmd2[cmd2_len++] = args[i];
+        return;
     }
-    cmd2[cmd2_len] = NULL;
 
-    if (pipe(pipefd) == -1)
+    /* Reject snapshots from another build or with offsets outside the file, summed in 64 bits so they cannot wrap */
+    struct snapshotHeader *header = (struct snapshotHeader *)base;
+    uint32_t size = st.st_size;
+    uint32_t historyBytes = MAX_HISTORY * MAX_LINE;
+    uint32_t pathBytes = PATH_CACHE_SIZE * sizeof(struct pathEntry);
+    if (memcmp(header->magic, "MYSHSNAP", 8) != 0 || header->version != SNAPSHOT_VERSION ||
+        header->size != size || header->maxLine != MAX_LINE || header->maxHistory != MAX_HISTORY ||
+        header->pathCacheSize != PATH_CACHE_SIZE ||
+        (uint64_t)header->historyOffset + historyBytes > size || (uint64_t)header->pathOffset + pathBytes > size ||
+        (uint64_t)header->aliasOffset + (uint64_t)header->aliasCount * 8 > size ||
+        header->poolOffset >= size || base[size - 1] != '\0' ||
+        header->pathEnvOffset < header->poolOffset || header->pathEnvOffset >= size ||
+        header->statsFileOffset >= size)
     {
-        fprintf(stderr, "Pipe creation failed");
+        fprintf(stderr, "Ignoring invalid state snapshot %s\n", snapshotPath);
+        munmap(base, st.st_size);
         return;
     }
+    snapshotBase = base;
+    snapshotSize = st.st_size;
 
-    pid1 = fork();
-    if (pid1 == 0)
+    /* History and path cache are used in place */
+    shellHistory = (char (*)[MAX_LINE])(base + header->historyOffset);
+    for (int i = 0; i < MAX_HISTORY; i++)
     {
-        /* First child process */
-        close(pipefd[0]);               // Close read end of the pipe (not used)
-        dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to child process to the pipe
-        close(pipefd[1]);               // Close write end of the pipe
-
-        char fullPath[MAX_LINE] = {0};
-        findCommandPath(cmd1[0], fullPath);
-        if (fullPath[0] == '\0')
-        {
-            fprintf(stderr, "Command not found: %s\n", cmd1[0]);
-            exit(1);
-        }
-
-        if (execv(fullPath, cmd1) == -1)
-        {
-            fprintf(stderr, "Command execution failed");
-            exit(1);
-        }
+        shellHistory[i][MAX_LINE - 1] = '\0';
     }
-
-    pid2 = fork();
-    if (pid2 == 0)
+    pathCache = (struct pathEntry *)(base + header->pathOffset);
+    for (int i = 0; i < PATH_CACHE_SIZE; i++)
     {
-        /* Second child */
-        close(pipefd[1]);              // Close write end of the pipe (not used)
-        dup2(pipefd[0], STDIN_FILENO); // Redirect stdin to child process from the pipe
-        close(pipefd[0]);              // Close read end of the pipe
+        pathCache[i].command[MAX_LINE - 1] = '\0';
+        pathCache[i].fullPath[MAX_LINE - 1] = '\0';
+    }
+    pathCacheEnv = strdup(base + header->pathEnvOffset); // findCommandPath() drops the cache if PATH changed
 
-        /* Handle redirection in cmd2 */
-        for (int i = 0; cmd2[i] != NULL; i++)
+    /* Alias entries point at the pooled strings, only the bucket links are built here */
+    uint32_t *pairs = (uint32_t *)(base + header->aliasOffset);
+    uint32_t count = header->aliasCount;
+    if (count > 0)
+    {
+        unsigned buckets = 16;
+        while (buckets < count)
         {
-            if (strcmp(cmd2[i], ">") == 0)
-            {
-                int fd = open(cmd2[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644); // Open file, create if not exists, truncate
-                if (fd < 0)
-                {
-                    fprintf(stderr, "Error opening file");
-                    exit(1);
-                }
-                dup2(fd, STDOUT_FILENO); // Redirect stdout to file
-                close(fd);               // Close file descriptor
-                cmd2[i] = NULL;
-                break;
-            }
-            else if (strcmp(cmd2[i], ">>") == 0)
-            {
-                int fd = open(cmd2[i + 1], O_WRONLY | O_CREAT | O_APPEND, 0644); // Open file, create if not exists, append
-                if (fd < 0)
-                {
-                    fprintf(stderr, "Error opening file");
-                    exit(1);
-                }
-                dup2(fd, STDOUT_FILENO); // Redirect stdout to file
-                close(fd);               // Close file descriptor
-                cmd2[i] = NULL;
-                break;
-            }
-            else if (strcmp(cmd2[i], "2>") == 0)
+            buckets *= 2;
+        }
+        snapshotAliases = calloc(count, sizeof(struct alias));
+        snapshotAliasCount = count;
+        aliasTable = calloc(buckets, sizeof(struct alias *));
+        aliasBuckets = buckets;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (pairs[2 * i] < header->poolOffset || pairs[2 * i] >= size ||
+                pairs[2 * i + 1] < header->poolOffset || pairs[2 * i + 1] >= size)
             {
-                int fd = open(cmd2[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644); // Open file, create if not exists, truncate
-                if (fd < 0)
-                {
-                    fprintf(stderr, "Error opening file");
-                    exit(1);
-                }
-                dup2(fd, STDERR_FILENO); // Redirect stderr to file
-                close(fd);               // Close file descriptor
-                cmd2[i] = NULL;
-                break;
+                continue;
             }
+            struct alias *entry = &snapshotAliases[i];
+            entry->name = base + pairs[2 * i];
+            entry->value = base + pairs[2 * i + 1];
+            unsigned slot = stringHash(entry->name) & (buckets - 1);
+            entry->next = aliasTable[slot];
+            aliasTable[slot] = entry;
+            aliasCount++;
         }
+    }
 
-        char fullPath[MAX_LINE] = {0};
-        findCommandPath(cmd2[0], fullPath);
-        if (fullPath[0] == '\0')
-        {
-            fprintf(stderr, "Command not found: %s\n", cmd2[0]);
-            exit(1);
-        }
+    /* Settings */
+    if (header->statsFileOffset != 0)
+    {
+        statsFile = strdup(base + header->statsFileOffset);
+        statsInterval = header->statsInterval;
+    }
+    snapshotSaved = nowMicros();
+}
 
-        if (execv(fullPath, cmd2) == -1)
-        {
-            fprintf(stderr, "Command execution failed");
-            exit(1);
-        }
+/* Appends a string to the snapshot pool and returns its offset */
+uint32_t snapshotString(char **buffer, size_t *length, size_t *capacity, const char *text)
+{
+    size_t need = strlen(text) + 1;
+    if (*length + need > *capacity)
+    {
+        *capacity = (*length + need) * 2;
+        *buffer = realloc(*buffer, *capacity);
     }
+    memcpy(*buffer + *length, text, need);
+    *length += need;
+    return *length - need;
+}
 
-    /* Parent process */
-    close(pipefd[0]); // Close read end of the pipe
-    close(pipefd[1]); // Close write end of the pipe
-    waitpid(pid1, NULL, 0); // Wait for child 1
-    waitpid(pid2, NULL, 0); // Wait for child 2
+/*
+ * Creates a temporary file with a unique name in the directory of path,
+ * for writing and renaming over path. Two shells saving at once each get
+ * their own. Returns the descriptor, or -1 with tmpPath holding the name
+ * that could not be created.
+ */
+int openTemporary(const char *path, char *tmpPath, size_t size)
+{
+    snprintf(tmpPath, size, "%s.XXXXXX", path);
+    return mkostemp(tmpPath, O_CLOEXEC);
 }
 
-/* Handles SIGTSTP (Ctrl+Z) */
-void handleSigTSTP(int sig)
+/* Writes the snapshot next to the old one and renames it over, so the current mapping stays valid */
+void snapshotSave(int force)
 {
-    if (fg_pid != -1)
+    if (snapshotPath == NULL)
     {
-        printf("\nCaught SIGTSTP (Ctrl+Z). Terminating foreground process %d and its descendants.\n", fg_pid);
-        kill(fg_pid, SIGTERM); // Terminate FG process
+        return;
     }
-    else
+    double now = nowMicros();
+    if (!interactive)
     {
-        fprintf(stderr, "\nNo foreground process to terminate.\n");
-        return;
+        return; // Scripts read the snapshot but never rewrite it
     }
-}
-
-/* Exits the shell */
-void terminateProgram(int bgCount)
-{
-    if (bgCount != 0)
+    if (!force && now - snapshotSaved < SNAPSHOT_INTERVAL * 1e6)
     {
-        printf("There are still background processes running!\n");
         return;
     }
-    else
+    snapshotSaved = now;
+
+    /* Fixed blocks first, the pool grows behind them */
+    struct snapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MYSHSNAP", 8);
+    header.version = SNAPSHOT_VERSION;
+    header.maxLine = MAX_LINE;
+    header.maxHistory = MAX_HISTORY;
+    header.pathCacheSize = PATH_CACHE_SIZE;
+    header.historyOffset = sizeof(header);
+    header.pathOffset = header.historyOffset + MAX_HISTORY * MAX_LINE;
+    header.aliasOffset = header.pathOffset + PATH_CACHE_SIZE * sizeof(struct pathEntry);
+    header.aliasCount = aliasCount;
+    header.poolOffset = header.aliasOffset + aliasCount * 2 * sizeof(uint32_t);
+
+    size_t capacity = header.poolOffset + 4096, length = header.poolOffset;
+    char *buffer = calloc(1, capacity);
+    if (buffer == NULL)
     {
-        printf("Exiting shell...\n");
-        exit(0);
+        return;
     }
-}
+    memcpy(buffer + header.historyOffset, shellHistory, MAX_HISTORY * MAX_LINE);
+    memcpy(buffer + header.pathOffset, pathCache, PATH_CACHE_SIZE * sizeof(struct pathEntry));
 
-/* Handles I/O redirection */
-int redirect(char *args[], int background)
-{
-    int i = 0;
-    while (args[i] != NULL)
+    header.pathEnvOffset = snapshotString(&buffer, &length, &capacity, pathCacheEnv ? pathCacheEnv : "");
+    uint32_t pair = 0;
+    for (unsigned i = 0; i < aliasBuckets; i++)
     {
-        if (strcmp("<", args[i]) == 0 || strcmp(">>", args[i]) == 0 ||
-            strcmp("2>", args[i]) == 0 || strcmp(">", args[i]) == 0)
+        for (struct alias *entry = aliasTable[i]; entry != NULL; entry = entry->next, pair++)
         {
-            break;
+            uint32_t offsets[2];
+            offsets[0] = snapshotString(&buffer, &length, &capacity, entry->name);
+            offsets[1] = snapshotString(&buffer, &length, &capacity, entry->value);
+            memcpy(buffer + header.aliasOffset + pair * sizeof(offsets), offsets, sizeof(offsets));
         }
-        i++;
     }
-
-    if (args[i] == NULL)
+    if (statsFile != NULL)
     {
-        return 0; // No redirection
+        header.statsFileOffset = snapshotString(&buffer, &length, &capacity, statsFile);
+        header.statsInterval = statsInterval;
     }
+    header.size = length;
+    memcpy(buffer, &header, sizeof(header));
 
-    if (args[i + 1] == NULL)
+    /* Synced before the rename, so the name never points at a partly written file */
+    char tmpPath[4096];
+    int fd = openTemporary(snapshotPath, tmpPath, sizeof(tmpPath));
+    if (fd < 0 || writeAll(fd, buffer, length, -1) < 0 || fsync(fd) < 0 || rename(tmpPath, snapshotPath) < 0)
     {
-        fprintf(stderr, "Missing argument.\n");
-        return 0;
+        fprintf(stderr, "Cannot save state to %s\n", tmpPath);
+        if (fd >= 0)
+        {
+            unlink(tmpPath);
+        }
     }
-
-    pid_t pid = fork();
-    if (pid < 0)
+    if (fd >= 0)
     {
-        fprintf(stderr, "Fork failed!\n");
-        return -1;
+        close(fd);
     }
+    free(buffer);
+}
 
-    if (pid == 0)
+/* Runs every line of a script held in memory, each line is copied once for parsing */
+void runScript(const char *text, size_t length)
+{
+    char line[MAX_LINE];
+    char *args[MAX_LINE / 2 + 1];
+    int lineNumber = 0;
+
+    scriptText = text;
+    scriptLength = length;
+    scriptPosition = 0;
+    while (scriptPosition < length)
     {
-        /* Child process */
-        if (strcmp(">", args[i]) == 0) // 
-        {
-            /* Output redirection */
-            int fd = open(args[i + 1], O_WRONLY | O_TRUNC | O_CREAT, 0644); // Open file, create if not exists, truncate
-            if (fd < 0)
-            {
-                fprintf(stderr, "Error opening file");
-                exit(1);
-            }
-            args[i] = NULL;
-            dup2(fd, STDOUT_FILENO); // Redirect stdout to file
-            close(fd);
-        }
-        else if (strcmp(">>", args[i]) == 0)
-        {
-            /* Append output redirection */
-            int fd = open(args[i + 1], O_WRONLY | O_APPEND | O_CREAT, 0644); // Open file, create if not exists, append
-            if (fd < 0)
-            {
-                fprintf(stderr, "Error opening file");
-                exit(1);
-            }
-            args[i] = NULL;
-            dup2(fd, STDOUT_FILENO); // Redirect stdout to file
-            close(fd);
-        }
-        else if (strcmp("2>", args[i]) == 0)
-        {
-            /* Error redirection */
-            int fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644); // Open file, create if not exists, truncate
-            if (fd < 0)
-            {
-                fprintf(stderr, "Error opening file");
-                exit(1);
-            }
-            args[i] = NULL;
-            dup2(fd, STDERR_FILENO); // Redirect stderr to file
-            close(fd);
-        }
-        else if (strcmp(args[i], "<") == 0)
-        {
-            /* Input redirection */
-            if (args[i + 2] != NULL && strcmp(args[i + 2], ">") == 0)
-            {
-                /* Handle input and output redirection */
-                if (args[i + 3] == NULL)
-                {
-                    fprintf(stderr, "Missing output file after '>'.\n");
-                    return 0;
-                }
-                int fd_in = open(args[i + 1], O_RDONLY);
-                if (fd_in < 0)
-                {
-                    fprintf(stderr, "Error opening input file");
-                    exit(1);
-                }
-                int fd_out = open(args[i + 3], O_WRONLY | O_CREAT | O_TRUNC, 0644); // Open output file
-                if (fd_out < 0)
-                {
-                    fprintf(stderr, "Error opening output file");
-                    exit(1);
-                }
-                dup2(fd_in, STDIN_FILENO); // Redirect stdin to input file
-                dup2(fd_out, STDOUT_FILENO); // Redirect stdout to output file
-                close(fd_in);
-                close(fd_out);
-                args[i] = NULL;
-            }
-            else
-            {
-                /* Only input redirection */
-                if (args[i + 1] == NULL)
-                {
-                    fprintf(stderr, "Missing input file after '<'.\n");
-                    return 0;
-                }
-                int fd_in = open(args[i + 1], O_RDONLY); // Open input file
-                if (fd_in < 0)
-                {
-                    fprintf(stderr, "Error opening input file");
-                    exit(1);
-                }
-                dup2(fd_in, STDIN_FILENO); // Redirect stdin to input file
-                close(fd_in);
-                args[i] = NULL;
-            }
-        }
-        char fullPath[MAX_LINE] = {0};
-        findCommandPath(args[0], fullPath);
+        size_t position = scriptPosition;
+        const char *end = memchr(text + position, '\n', length - position);
+        size_t lineLength = (end != NULL ? end : text + length) - (text + position);
+        scriptPosition += lineLength + 1;
+        lineNumber++;
 
-        if (execv(fullPath, args) == -1)
+        if (lineLength >= MAX_LINE)
         {
-            fprintf(stderr, "Command execution failed");
-            exit(1);
+            fprintf(stderr, "Line %d is longer than %d characters, skipped.\n", lineNumber, MAX_LINE - 1);
+            continue;
         }
-    }
-    else
-    {
-        /* Parent process */
-        if (!background)
+        memcpy(line, text + position, lineLength);
+        arenaReset();
+        parseLine(line, lineLength, args);
+        collectHereDocs(args); // Moves scriptPosition past the bodies
+
+        /* Only blanks left after this line, its last command can replace the shell */
+        size_t rest = scriptPosition;
+        while (rest < length && (text[rest] == '\n' || text[rest] == ' ' || text[rest] == '\t'))
         {
-            waitpid(pid, NULL, 0);
+            rest++;
         }
+        executeLine(args, rest >= length);
     }
-    return 1;
+    scriptText = NULL;
 }
 
-/* Handles SIGCHLD (child termination) */
-void handleSigCHLD(int sig)
+/* Maps a script file and runs it */
+void runScriptFile(const char *path)
 {
-    pid_t pid;
-    int status;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) 
-    // WNOHANG: This flag tells waitpid or wait to return immediately if no child process has exited, rather than blocking the calling process.
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        /* Remove terminated process from background processes */
-        for (int i = 0; i < bgCount; i++)
-        {
-            if (bgProcesses[i] == pid)
-            {
-                for (int j = i; j < bgCount - 1; j++)
-                {
-                    bgProcesses[j] = bgProcesses[j + 1];
-                }
-                bgCount--;
-                break;
-            }
-        }
+        fprintf(stderr, "Cannot open script %s\n", path);
+        exit(127);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "Cannot read script %s\n", path);
+        exit(127);
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map script %s\n", path);
+        exit(127);
     }
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+    runScript(text, st.st_size);
+    munmap(text, st.st_size);
 }